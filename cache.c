@@ -0,0 +1,212 @@
+/**
+ *  cache.c
+ */
+#include "cache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the cache file name suffix                                            */
+#define CACHE_SUFFIX           ".cache"
+
+/* size of the blocks hashed at a time                                   */
+#define HASH_BLOCK          65536
+
+/* FNV-1a 64-bit parameters                                              */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x00000100000001b3ULL
+
+/** the start of a cache file                                            */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t input_hash;
+    uint64_t input_size;
+    uint32_t rows;
+    uint32_t columns;
+    uint64_t tdline_size;
+} Cache_header;
+
+/* the mapping handed out by cache_load                                  */
+static void *mapping = NULL;
+static size_t mapping_size = 0;
+
+/**
+    returns the cache file name of a spreadsheet
+*/
+static char *cache_path(const char *input) {
+    char *path = (char *) malloc(strlen(input) + strlen(CACHE_SUFFIX) + 1);
+    if (path != NULL)
+        sprintf(path, "%s%s", input, CACHE_SUFFIX);
+    return path;
+}
+
+int cache_key(const char *input, Cache_key *key) {
+    unsigned char *block = (unsigned char *) malloc(HASH_BLOCK);
+    FILE *fp = fopen(input, "rb");
+    uint64_t hash = FNV_OFFSET;
+    uint64_t size = 0;
+    size_t n;
+
+    if (fp == NULL || block == NULL) {
+        if (fp)
+            fclose(fp);
+        free(block);
+        return -1;
+    }
+
+    while ((n = fread(block, 1, HASH_BLOCK, fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= block[i];
+            hash *= FNV_PRIME;
+        }
+        size += n;
+    }
+
+    int status = ferror(fp) ? -1 : 0;
+    fclose(fp);
+    free(block);
+
+    key->hash = hash;
+    key->size = size;
+    return status;
+}
+
+Label_record *cache_load(const char *input, const Cache_key *key, Sheet_header *header, int *rows) {
+    char *path = cache_path(input);
+    int fd = path ? open(path, O_RDONLY) : -1;
+    struct stat st;
+
+    free(path);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Cache_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    // private and writable: printing the records only touches a copy
+    void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const Cache_header *cache = (const Cache_header *) base;
+    Label_record *labels = (Label_record *) ((char *) base + sizeof(Cache_header));
+    char *tdlines = (char *) (labels + cache->rows);
+    const int32_t *columns = (const int32_t *) (tdlines + cache->tdline_size);
+
+    if (memcmp(cache->magic, "STOICACH", 8) != 0 ||
+        cache->version != CACHE_VERSION ||
+        cache->record_size != sizeof(Label_record) ||
+        cache->input_hash != key->hash ||
+        cache->input_size != key->size ||
+        cache->rows < 1 || cache->rows > INT32_MAX ||
+        cache->columns > MAX_COLUMNS ||
+        (uint64_t) st.st_size != sizeof(Cache_header) + (uint64_t) cache->rows * sizeof(Label_record) +
+                                 cache->tdline_size + cache->columns * sizeof(int32_t) ||
+        (cache->tdline_size > 0 && tdlines[cache->tdline_size - 1] != '\0')) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < cache->rows; i++) {
+        uintptr_t offset = (uintptr_t) labels[i].tdline;
+        if (offset > cache->tdline_size) {
+            munmap(base, st.st_size);
+            return NULL;
+        }
+        labels[i].tdline = offset ? tdlines + offset - 1 : NULL;
+    }
+
+    // the column headings, as indexes into column_defs (the texts may be unaligned)
+    header->count = (int) cache->columns;
+    header->last = 0;
+    for (int c = 0; c < header->count; c++) {
+        int32_t index;
+        memcpy(&index, columns + c, sizeof(index));
+        if (index >= column_defs_size) {
+            munmap(base, st.st_size);
+            return NULL;
+        }
+        header->columns[c] = index < 0 ? NULL : &column_defs[index];
+        header->slots[c] = column_slot(header->columns[c]);
+        if (index >= 0)
+            header->last = c + 1;
+    }
+
+    mapping = base;
+    mapping_size = st.st_size;
+    *rows = (int) cache->rows;
+    return labels;
+}
+
+int cache_store(const char *input, const Cache_key *key, const Sheet_header *header,
+                const Label_record *labels, int rows) {
+    Cache_header cache = {"STOICACH", CACHE_VERSION, sizeof(Label_record), key->hash, key->size,
+                          (uint32_t) rows, (uint32_t) header->count, 0};
+    char *path = cache_path(input);
+    char *temp = path ? (char *) malloc(strlen(path) + 2) : NULL;
+    FILE *fp;
+    int status = 0;
+
+    if (temp == NULL) {
+        free(path);
+        return -1;
+    }
+
+    // written under a temporary name, so a failed run never leaves a partial cache
+    sprintf(temp, "%s~", path);
+    if ((fp = fopen(temp, "wb")) == NULL) {
+        free(temp);
+        free(path);
+        return -1;
+    }
+
+    for (int i = 0; i < rows; i++)
+        if (labels[i].tdline)
+            cache.tdline_size += strlen(labels[i].tdline) + 1;
+    fwrite(&cache, sizeof(cache), 1, fp);
+
+    uint64_t offset = 0;
+    for (int i = 0; i < rows; i++) {
+        Label_record record = labels[i];
+        if (record.tdline) {
+            record.tdline = (char *) (uintptr_t) (offset + 1);
+            offset += strlen(labels[i].tdline) + 1;
+        }
+        fwrite(&record, sizeof(record), 1, fp);
+    }
+    for (int i = 0; i < rows; i++)
+        if (labels[i].tdline)
+            fwrite(labels[i].tdline, 1, strlen(labels[i].tdline) + 1, fp);
+    for (int c = 0; c < header->count; c++) {
+        int32_t index = header->columns[c] ? (int32_t) (header->columns[c] - column_defs) : -1;
+        fwrite(&index, sizeof(index), 1, fp);
+    }
+
+    if (ferror(fp))
+        status = -1;
+    if (fclose(fp) != 0)
+        status = -1;
+    if (status == 0 && rename(temp, path) != 0)
+        status = -1;
+    if (status != 0)
+        remove(temp);
+
+    free(temp);
+    free(path);
+    return status;
+}
+
+void cache_release(void) {
+    if (mapping != NULL)
+        munmap(mapping, mapping_size);
+    mapping = NULL;
+    mapping_size = 0;
+}
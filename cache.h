@@ -0,0 +1,68 @@
+/**
+    @file cache.h
+    Together with cache.c, this component is responsible for the --cache
+    file that holds the parsed and sorted label records of a spreadsheet,
+    so that a re-run on an unchanged sheet goes straight to printing.
+
+    The cache file "<input>.cache" (native byte order) is laid out as
+        Cache_header            magic, version, key and sizes
+        Label_record[rows]      the records; tdline holds an offset + 1
+        char[tdline_size]       the null-terminated TDLINE texts
+        int32_t[columns]        the column_defs index of each column, or -1
+    and is mapped copy-on-write, so the records can be used in place.
+*/
+
+#ifndef STOIDOC_CACHE_H
+#define STOIDOC_CACHE_H
+
+#include <stdint.h>
+
+#include "label.h"
+
+/* version of the cache file layout; bump it when parsing changes        */
+#define CACHE_VERSION           7
+
+/** identifies the spreadsheet contents a cache file was built from      */
+typedef struct {
+    uint64_t hash;
+    uint64_t size;
+} Cache_key;
+
+/**
+    computes the key of a spreadsheet file: a FNV-1a hash of its bytes
+    @param input is the spreadsheet file name
+    @param key receives the key
+    @return 0 if successful, -1 if the file cannot be read
+*/
+int cache_key(const char *input, Cache_key *key);
+
+/**
+    maps the cache file of a spreadsheet if it matches the key, the cache
+    version and the record layout. The records hold the non-SAP fields
+    whether or not -n is given, so one cache file serves both.
+    @param input is the spreadsheet file name
+    @param key is the key of the spreadsheet
+    @param header receives the resolved column headings
+    @param rows receives the number of rows, including the heading row
+    @return the label records, or NULL if there is no usable cache file
+*/
+Label_record *cache_load(const char *input, const Cache_key *key, Sheet_header *header, int *rows);
+
+/**
+    writes the cache file of a spreadsheet
+    @param input is the spreadsheet file name
+    @param key is the key of the spreadsheet
+    @param header contains the resolved column headings
+    @param labels is the sorted label record array
+    @param rows is the number of rows, including the heading row
+    @return 0 if successful, -1 if unsuccessful
+*/
+int cache_store(const char *input, const Cache_key *key, const Sheet_header *header,
+                const Label_record *labels, int rows);
+
+/**
+    unmaps the label records returned by cache_load
+*/
+void cache_release(void);
+
+#endif //STOIDOC_CACHE_H
@@ -0,0 +1,496 @@
+/**
+ *  compress.c
+ */
+#include "compress.h"
+#include "xlsx.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/* size of the chunks moved from the pipe to the compressor              */
+#define CHUNK_SIZE      (256 * 1024)
+
+/* maximum number of compressed streams open at the same time            */
+#define MAX_STREAMS            4
+
+/* length of the longest magic number that identifies a compressed file   */
+#define MAGIC_LEN              4
+
+/** a compressed stream and the thread that drains or feeds it           */
+typedef struct {
+    FILE *fp;
+    FILE *file;
+    int method;
+    int input;
+    int pipe_fd;
+    int status;
+    unsigned char magic[MAGIC_LEN];
+    size_t magic_len;
+    pthread_t thread;
+} Compress_stream;
+
+static Compress_stream streams[MAX_STREAMS];
+
+int compress_method(const char *name) {
+    if (strcasecmp(name, "gzip") == 0 || strcasecmp(name, "gz") == 0)
+        return COMPRESS_GZIP;
+    else if (strcasecmp(name, "zstd") == 0 || strcasecmp(name, "zst") == 0)
+        return COMPRESS_ZSTD;
+    return -1;
+}
+
+const char *compress_extension(int method) {
+    if (method == COMPRESS_GZIP)
+        return ".gz";
+    else if (method == COMPRESS_ZSTD)
+        return ".zst";
+    return "";
+}
+
+int compress_available(int method) {
+#ifdef HAVE_ZLIB
+    if (method == COMPRESS_GZIP || method == COMPRESS_XLSX)
+        return 1;
+#endif
+#ifdef HAVE_ZSTD
+    if (method == COMPRESS_ZSTD)
+        return 1;
+#endif
+    return method == COMPRESS_NONE;
+}
+
+#ifdef HAVE_ZLIB
+/**
+    drains the pipe into a gzip stream
+    @param cs is the compressed stream
+    @param buffer is a CHUNK_SIZE work buffer
+    @return 0 if successful, -1 otherwise
+*/
+static int deflate_pipe(Compress_stream *cs, unsigned char *buffer) {
+    unsigned char *out = (unsigned char *) malloc(CHUNK_SIZE);
+    z_stream zs = {0};
+    ssize_t n;
+    int status = 0;
+
+    // windowBits 15 + 16 selects the gzip wrapper
+    if (out == NULL || deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                                    Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(out);
+        return -1;
+    }
+
+    do {
+        n = read(cs->pipe_fd, buffer, CHUNK_SIZE);
+        if (n < 0) {
+            status = -1;
+            n = 0;
+        }
+        zs.next_in = buffer;
+        zs.avail_in = (uInt) n;
+        do {
+            zs.next_out = out;
+            zs.avail_out = CHUNK_SIZE;
+            if (deflate(&zs, n == 0 ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+                status = -1;
+                break;
+            }
+            size_t have = CHUNK_SIZE - zs.avail_out;
+            if (fwrite(out, 1, have, cs->file) != have)
+                status = -1;
+        } while (zs.avail_out == 0);
+    } while (n > 0);
+
+    deflateEnd(&zs);
+    free(out);
+    return status;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+    drains the pipe into a zstd frame
+    @param cs is the compressed stream
+    @param buffer is a CHUNK_SIZE work buffer
+    @return 0 if successful, -1 otherwise
+*/
+static int zstd_pipe(Compress_stream *cs, unsigned char *buffer) {
+    size_t out_size = ZSTD_CStreamOutSize();
+    unsigned char *out = (unsigned char *) malloc(out_size);
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ssize_t n;
+    int status = 0;
+
+    if (out == NULL || cctx == NULL) {
+        free(out);
+        ZSTD_freeCCtx(cctx);
+        return -1;
+    }
+
+    do {
+        n = read(cs->pipe_fd, buffer, CHUNK_SIZE);
+        if (n < 0) {
+            status = -1;
+            n = 0;
+        }
+        ZSTD_EndDirective mode = n == 0 ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = {buffer, (size_t) n, 0};
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = {out, out_size, 0};
+            remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                status = -1;
+                break;
+            }
+            if (fwrite(out, 1, output.pos, cs->file) != output.pos)
+                status = -1;
+        } while (mode == ZSTD_e_end ? remaining != 0 : input.pos != input.size);
+    } while (n > 0);
+
+    ZSTD_freeCCtx(cctx);
+    free(out);
+    return status;
+}
+#endif
+
+/**
+    compressor thread: reads the records printed to the pipe until the
+    writing end is closed
+    @param arg is the Compress_stream
+    @return NULL
+*/
+static void *compress_thread(void *arg) {
+    Compress_stream *cs = (Compress_stream *) arg;
+    unsigned char *buffer = (unsigned char *) malloc(CHUNK_SIZE);
+
+    cs->status = -1;
+    if (buffer != NULL) {
+#ifdef HAVE_ZLIB
+        if (cs->method == COMPRESS_GZIP)
+            cs->status = deflate_pipe(cs, buffer);
+#endif
+#ifdef HAVE_ZSTD
+        if (cs->method == COMPRESS_ZSTD)
+            cs->status = zstd_pipe(cs, buffer);
+#endif
+        // keep draining so the writer never blocks on a failed compressor
+        while (read(cs->pipe_fd, buffer, CHUNK_SIZE) > 0);
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+    writes a whole buffer to the pipe, retrying partial writes
+    @param fd is the writing end of the pipe
+    @param buffer holds the decoded bytes
+    @param n is the number of bytes to write
+    @return 0 if successful, -1 if the reading end was closed
+*/
+static int write_pipe(int fd, const unsigned char *buffer, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(fd, buffer, n);
+        if (written <= 0)
+            return -1;
+        buffer += written;
+        n -= (size_t) written;
+    }
+    return 0;
+}
+
+/**
+    reads the next chunk of the input file, starting with the magic bytes
+    that were consumed while detecting the compression method
+    @param cs is the compressed stream
+    @param buffer is a CHUNK_SIZE work buffer
+    @return the number of bytes read, 0 at the end of the file
+*/
+static size_t read_file(Compress_stream *cs, unsigned char *buffer) {
+    size_t n = 0;
+    if (cs->magic_len > 0) {
+        memcpy(buffer, cs->magic, cs->magic_len);
+        n = cs->magic_len;
+        cs->magic_len = 0;
+    }
+    return n + fread(buffer + n, 1, CHUNK_SIZE - n, cs->file);
+}
+
+#ifdef HAVE_ZLIB
+/**
+    decodes one or more concatenated gzip members into the pipe
+    @param cs is the compressed stream
+    @param buffer is a CHUNK_SIZE work buffer
+    @return 0 if successful, -1 otherwise
+*/
+static int inflate_pipe(Compress_stream *cs, unsigned char *buffer) {
+    unsigned char *out = (unsigned char *) malloc(CHUNK_SIZE);
+    z_stream zs = {0};
+    int status = 0;
+    int ret;
+    bool finished = false;
+
+    // windowBits 15 + 32 detects the gzip or zlib header automatically
+    if (out == NULL || inflateInit2(&zs, 15 + 32) != Z_OK) {
+        free(out);
+        return -1;
+    }
+
+    while (status == 0 && (zs.avail_in = (uInt) read_file(cs, buffer)) > 0) {
+        zs.next_in = buffer;
+        // a full output buffer may leave decoded bytes inside inflate
+        do {
+            // the next member starts only once there is input for it
+            if (finished) {
+                if (zs.avail_in == 0)
+                    break;
+                inflateReset(&zs);
+                finished = false;
+            }
+            zs.next_out = out;
+            zs.avail_out = CHUNK_SIZE;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+                status = -1;
+            else if (write_pipe(cs->pipe_fd, out, CHUNK_SIZE - zs.avail_out) != 0)
+                status = -1;
+            else if (ret == Z_STREAM_END)
+                finished = true;
+        } while (status == 0 && (zs.avail_in > 0 || zs.avail_out == 0));
+    }
+
+    // a truncated file ends in the middle of a member
+    if (!finished || ferror(cs->file))
+        status = -1;
+
+    inflateEnd(&zs);
+    free(out);
+    return status;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+    decodes one or more zstd frames into the pipe
+    @param cs is the compressed stream
+    @param buffer is a CHUNK_SIZE work buffer
+    @return 0 if successful, -1 otherwise
+*/
+static int unzstd_pipe(Compress_stream *cs, unsigned char *buffer) {
+    size_t out_size = ZSTD_DStreamOutSize();
+    unsigned char *out = (unsigned char *) malloc(out_size);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t n, ret = 0;
+    int status = 0;
+
+    if (out == NULL || dctx == NULL) {
+        free(out);
+        ZSTD_freeDCtx(dctx);
+        return -1;
+    }
+
+    while (status == 0 && (n = read_file(cs, buffer)) > 0) {
+        ZSTD_inBuffer input = {buffer, n, 0};
+        ZSTD_outBuffer output;
+        // a full output buffer may leave decoded bytes inside the decoder
+        do {
+            output = (ZSTD_outBuffer) {out, out_size, 0};
+            ret = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(ret) || write_pipe(cs->pipe_fd, out, output.pos) != 0)
+                status = -1;
+        } while (status == 0 && (input.pos < input.size || output.pos == output.size));
+    }
+
+    // a non-zero hint means the last frame is incomplete
+    if (ret != 0 || ferror(cs->file))
+        status = -1;
+
+    ZSTD_freeDCtx(dctx);
+    free(out);
+    return status;
+}
+#endif
+
+/**
+    decompressor thread: feeds the decoded spreadsheet into the pipe until
+    the end of the input file
+    @param arg is the Compress_stream
+    @return NULL
+*/
+static void *decompress_thread(void *arg) {
+    Compress_stream *cs = (Compress_stream *) arg;
+    unsigned char *buffer = (unsigned char *) malloc(CHUNK_SIZE);
+
+    cs->status = -1;
+    if (buffer != NULL) {
+#ifdef HAVE_ZLIB
+        if (cs->method == COMPRESS_GZIP)
+            cs->status = inflate_pipe(cs, buffer);
+        if (cs->method == COMPRESS_XLSX)
+            cs->status = xlsx_convert(cs->file, cs->pipe_fd);
+#endif
+#ifdef HAVE_ZSTD
+        if (cs->method == COMPRESS_ZSTD)
+            cs->status = unzstd_pipe(cs, buffer);
+#endif
+        if (cs->method == COMPRESS_NONE) {
+            size_t n;
+            cs->status = 0;
+            while ((n = read_file(cs, buffer)) > 0)
+                if (write_pipe(cs->pipe_fd, buffer, n) != 0) {
+                    cs->status = -1;
+                    break;
+                }
+        }
+    }
+    free(buffer);
+
+    // closing the writing end delivers EOF to the spreadsheet reader
+    close(cs->pipe_fd);
+    return NULL;
+}
+
+/**
+    finds a free stream slot
+    @return the free slot, or NULL if MAX_STREAMS streams are open
+*/
+static Compress_stream *stream_slot() {
+    for (int i = 0; i < MAX_STREAMS; i++)
+        if (streams[i].fp == NULL)
+            return &streams[i];
+    return NULL;
+}
+
+FILE *compress_open_input(FILE *file) {
+    unsigned char magic[MAGIC_LEN];
+    size_t magic_len = fread(magic, 1, MAGIC_LEN, file);
+    int method = COMPRESS_NONE;
+    Compress_stream *cs;
+    int fds[2];
+
+    if ((magic_len >= 2) && (magic[0] == 0x1f) && (magic[1] == 0x8b))
+        method = COMPRESS_GZIP;
+    else if ((magic_len == 4) && (magic[0] == 0x28) && (magic[1] == 0xb5) &&
+             (magic[2] == 0x2f) && (magic[3] == 0xfd))
+        method = COMPRESS_ZSTD;
+    else if (xlsx_magic(magic, magic_len))
+        method = COMPRESS_XLSX;
+
+    if (!compress_available(method))
+        return NULL;
+
+    // the directory of a workbook is at its end
+    if ((method == COMPRESS_XLSX) && (fseek(file, 0, SEEK_SET) != 0))
+        return NULL;
+
+    // plain text is read directly unless it came from a pipe
+    if ((method == COMPRESS_NONE) && (fseek(file, 0, SEEK_SET) == 0))
+        return file;
+
+    if ((cs = stream_slot()) == NULL || pipe(fds) != 0)
+        return NULL;
+
+    // the reader may stop early; report EPIPE to the thread instead of dying
+    signal(SIGPIPE, SIG_IGN);
+
+    cs->file = file;
+    cs->method = method;
+    cs->input = 1;
+    cs->pipe_fd = fds[1];
+    memcpy(cs->magic, magic, magic_len);
+    cs->magic_len = magic_len;
+    if ((cs->fp = fdopen(fds[0], "r")) == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    if (pthread_create(&cs->thread, NULL, decompress_thread, cs) != 0) {
+        fclose(cs->fp);
+        close(fds[1]);
+        memset(cs, 0, sizeof(*cs));
+        return NULL;
+    }
+    return cs->fp;
+}
+
+FILE *compress_open_output(const char *path, int method) {
+    FILE *file, *fp;
+
+    if (!compress_available(method) || method == COMPRESS_NONE)
+        return NULL;
+
+    if ((file = fopen(path, "wb")) == NULL)
+        return NULL;
+
+    if ((fp = compress_wrap_output(file, method)) == NULL)
+        fclose(file);
+    return fp;
+}
+
+FILE *compress_wrap_output(FILE *file, int method) {
+    Compress_stream *cs;
+    int fds[2];
+
+    if (!compress_available(method) || method == COMPRESS_NONE)
+        return NULL;
+
+    if ((cs = stream_slot()) == NULL)
+        return NULL;
+
+    cs->file = file;
+    if (pipe(fds) != 0) {
+        cs->file = NULL;
+        return NULL;
+    }
+
+    cs->method = method;
+    cs->pipe_fd = fds[0];
+    if ((cs->fp = fdopen(fds[1], "w")) == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        memset(cs, 0, sizeof(*cs));
+        return NULL;
+    }
+    setvbuf(cs->fp, NULL, _IOFBF, CHUNK_SIZE);
+
+    if (pthread_create(&cs->thread, NULL, compress_thread, cs) != 0) {
+        fclose(cs->fp);
+        close(fds[0]);
+        memset(cs, 0, sizeof(*cs));
+        return NULL;
+    }
+    return cs->fp;
+}
+
+int compress_close(FILE *fp) {
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        Compress_stream *cs = &streams[i];
+        if (cs->fp == fp && fp != NULL) {
+            // closing the writing end delivers EOF to the compressor thread,
+            // closing the reading end stops an unfinished decompressor
+            int status = fclose(cs->fp) == 0 ? 0 : -1;
+            pthread_join(cs->thread, NULL);
+            if (!cs->input)
+                close(cs->pipe_fd);
+            if (cs->status != 0)
+                status = -1;
+            if (fclose(cs->file) != 0)
+                status = -1;
+            memset(cs, 0, sizeof(*cs));
+            return status;
+        }
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,83 @@
+/**
+    @file compress.h
+    Together with compress.c, this component is responsible for streaming
+    compression of the IDoc output file and decompression of the label
+    spreadsheet. The record writer and the spreadsheet reader keep using
+    ordinary FILE pointers; a (de)compressor thread sits at the other end
+    of a pipe and handles the compressed stream.
+*/
+
+#ifndef STOIDOC_COMPRESS_H
+#define STOIDOC_COMPRESS_H
+
+#include <stdio.h>
+
+/* compression methods                                                   */
+#define COMPRESS_NONE           0
+#define COMPRESS_GZIP           1
+#define COMPRESS_ZSTD           2
+
+/* input only: an Excel workbook, converted to text by xlsx.c            */
+#define COMPRESS_XLSX           3
+
+/**
+    translates a --compress= method name into a compression method
+    @param name is "gzip" or "zstd" (case insensitive)
+    @return the compression method, or -1 if the name is not recognized
+*/
+int compress_method(const char *name);
+
+/**
+    returns the file name extension appended to a compressed output file
+    @param method is the compression method
+    @return ".gz", ".zst" or an empty string
+*/
+const char *compress_extension(int method);
+
+/**
+    reports whether a compression method was compiled into this build
+    @param method is the compression method
+    @return true (non-zero) if the method is available
+*/
+int compress_available(int method);
+
+/**
+    opens path for writing through a streaming compressor running on its
+    own thread. The returned stream must be closed with compress_close.
+    @param path is the compressed output file
+    @param method is the compression method
+    @return a stream to print records to, or NULL on error
+*/
+FILE *compress_open_output(const char *path, int method);
+
+/**
+    writes an already opened file through a streaming compressor running on
+    its own thread. The returned stream must be closed with compress_close,
+    which also closes the file.
+    @param file is the opened output file
+    @param method is the compression method
+    @return a stream to print records to, or NULL on error
+*/
+FILE *compress_wrap_output(FILE *file, int method);
+
+/**
+    inspects the magic bytes at the start of an opened input file. gzip and
+    zstd files are decoded, and the first worksheet of an .xlsx workbook is
+    converted to tab-delimited rows, by a thread that feeds the returned
+    stream; anything else is returned as plain text. A workbook must be read
+    from a seekable file. The returned stream must be
+    closed with compress_close.
+    @param file is the opened input file
+    @return a stream to read the spreadsheet from, or NULL on error
+*/
+FILE *compress_open_input(FILE *file);
+
+/**
+    closes a stream opened by compress_open_output or compress_open_input,
+    waits for its (de)compressor thread to finish and closes the file.
+    @param fp is the stream to close
+    @return 0 if successful, -1 if the file could not be written or decoded
+*/
+int compress_close(FILE *fp);
+
+#endif //STOIDOC_COMPRESS_H
@@ -0,0 +1,204 @@
+/**
+ *  duplicates.c
+ */
+#include "duplicates.h"
+#include "memory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a 64-bit parameters                                              */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x00000100000001b3ULL
+
+static const char *policy_names[] = {"keep", "error", "first", "last", "merge"};
+
+int duplicates_policy(const char *name) {
+    // every row is kept unless a policy is given, so "keep" is not one
+    for (int p = DUPLICATES_ERROR; p <= DUPLICATES_MERGE; p++)
+        if (strcmp(name, policy_names[p]) == 0)
+            return p;
+    return -1;
+}
+
+static uint64_t hash_label(const char *label) {
+    uint64_t hash = FNV_OFFSET;
+    for (; *label; label++) {
+        hash ^= (unsigned char) *label;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+    fills the empty cells of a record from a later record of the same
+    LABEL. An empty symbol cell is stored as N, so N is filled as well.
+    @param header contains the resolved column headings
+    @param keep is the record that is kept
+    @param other is the record that is dropped
+    @return true if keep now points at the TDLINE in the row of other
+*/
+static bool merge_record(const Sheet_header *header, Label_record *keep, const Label_record *other) {
+    bool borrowed = false;
+
+    for (int c = 0; c < header->last; c++) {
+        const Column_def *def = header->columns[c];
+        if (def == NULL)
+            continue;
+
+        int slot = header->slots[c];
+        switch (def->kind) {
+            case FIELD_TEXT:
+            case FIELD_TEXT_SET:
+                if (keep->cells[slot] == CELL_EMPTY && other->cells[slot] != CELL_EMPTY) {
+                    memcpy((char *) keep + def->offset, (const char *) other + def->offset, def->size);
+                    keep->cells[slot] = other->cells[slot];
+                }
+                break;
+            case FIELD_TDLINE:
+                if (keep->cells[slot] == CELL_EMPTY && other->cells[slot] != CELL_EMPTY) {
+                    keep->tdline = other->tdline;
+                    keep->cells[slot] = other->cells[slot];
+                    borrowed = true;
+                }
+                break;
+            case FIELD_SYMBOL:
+            case FIELD_YES:
+                if (get_symbol(keep, def->symbol) <= CELL_N && get_symbol(other, def->symbol) > CELL_N)
+                    set_symbol(keep, def->symbol, get_symbol(other, def->symbol));
+                break;
+            default:
+                break;
+        }
+    }
+    decode_fields(keep);
+    return borrowed;
+}
+
+/**
+    releases the memory charged for a dropped row: its TDLINE text, which
+    parse_shard moved to MEM_TDLINE, and the rest of the row
+    @param bytes is the size of the row as it was read
+    @param tdline is the TDLINE text in the row, or NULL
+*/
+static void release_row(size_t bytes, const char *tdline) {
+    long long text = tdline ? (long long) strlen(tdline) : 0;
+
+    memory_charge(MEM_TDLINE, -text);
+    memory_charge(MEM_ROWS, -((long long) bytes - text));
+}
+
+/**
+    swaps two spreadsheet rows, so that a record and the row holding its
+    TDLINE stay together
+*/
+static void swap_rows(int i, int j) {
+    char *row = spreadsheet[i];
+    spreadsheet[i] = spreadsheet[j];
+    spreadsheet[j] = row;
+}
+
+int duplicates_resolve(const Sheet_header *header, Label_record *labels, int policy) {
+    int rows = spreadsheet_row_number;
+    size_t cap = 1;
+    int found = 0;
+
+    // the index holds the first row of each LABEL; row 0 (the headings) marks an empty bucket
+    while (cap < 2 * (size_t) rows)
+        cap *= 2;
+    int *index = (int *) calloc(cap, sizeof(int));
+    bool *dropped = (bool *) calloc(rows, sizeof(bool));
+
+    if (index == NULL || dropped == NULL) {
+        free(index);
+        free(dropped);
+        printf("Could not allocate the LABEL index.\n");
+        return -1;
+    }
+    memory_charge(MEM_LOOKUP, (long long) (cap * sizeof(int) + rows * sizeof(bool)));
+
+    for (int i = 1; i < rows; i++) {
+        size_t b = hash_label(labels[i].label) & (cap - 1);
+        while (index[b] != 0 && strcmp(labels[index[b]].label, labels[i].label) != 0)
+            b = (b + 1) & (cap - 1);
+
+        if (index[b] == 0) {
+            index[b] = i;
+            continue;
+        }
+
+        int first = index[b];
+        duplicates_report(labels[i].label, i, first);
+        found++;
+
+        // the row that is dropped is released as it was charged
+        if (policy == DUPLICATES_LAST) {
+            // the last row takes the place of the first one
+            release_row(labels[first].row_bytes, labels[first].tdline);
+            labels[first] = labels[i];
+            swap_rows(first, i);
+            dropped[i] = true;
+        } else if (policy == DUPLICATES_MERGE) {
+            size_t bytes = labels[first].row_bytes;
+            const char *tdline = labels[first].tdline;
+
+            if (merge_record(header, &labels[first], &labels[i])) {
+                // the first record now points into the later row, so its own row goes
+                release_row(bytes, tdline);
+                labels[first].row_bytes = labels[i].row_bytes;
+                swap_rows(first, i);
+            } else
+                release_row(labels[i].row_bytes, labels[i].tdline);
+            dropped[i] = true;
+        } else if (policy == DUPLICATES_FIRST) {
+            release_row(labels[i].row_bytes, labels[i].tdline);
+            dropped[i] = true;
+        }
+    }
+
+    // the rows of the dropped records are no longer referenced
+    int kept = 1;
+    for (int i = 1; i < rows; i++) {
+        if (dropped[i]) {
+            free(spreadsheet[i]);
+        } else {
+            labels[kept] = labels[i];
+            spreadsheet[kept] = spreadsheet[i];
+            kept++;
+        }
+    }
+    spreadsheet_row_number = kept;
+
+    memory_charge(MEM_LOOKUP, -(long long) (cap * sizeof(int) + rows * sizeof(bool)));
+    free(index);
+    free(dropped);
+
+    if (found > 0 && policy == DUPLICATES_ERROR) {
+        printf("%d duplicate LABEL records (--duplicates=error). Aborting.\n", found);
+        return -1;
+    }
+    if (found > 0 && policy != DUPLICATES_KEEP)
+        printf("%d duplicate LABEL records resolved (--duplicates=%s).\n", found, policy_names[policy]);
+    return found;
+}
+
+void duplicates_report(const char *label, int record, int first) {
+    printf("Duplicate LABEL \"%s\" in record %d repeats record %d.\n", label, record, first);
+}
+
+int duplicates_replay(const Label_record *labels, int rows) {
+    int found = 0;
+    int first = 1;
+
+    for (int i = 2; i < rows; i++) {
+        if (strcmp(labels[i].label, labels[first].label) != 0) {
+            first = i;
+            continue;
+        }
+        duplicates_report(labels[i].label, i, first);
+        found++;
+    }
+    return found;
+}
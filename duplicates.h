@@ -0,0 +1,62 @@
+/**
+    @file duplicates.h
+    Together with duplicates.c, this component is responsible for finding
+    spreadsheet rows that share a LABEL and for resolving them by the
+    --duplicates= policy before anything is printed.
+*/
+
+#ifndef STOIDOC_DUPLICATES_H
+#define STOIDOC_DUPLICATES_H
+
+#include "label.h"
+
+/* what is done with the rows of a LABEL that is already in the sheet    */
+enum duplicates_policy {
+    DUPLICATES_KEEP,        // report them, and print every row (the default)
+    DUPLICATES_ERROR,       // report them, and abort
+    DUPLICATES_FIRST,       // keep the first row of each LABEL
+    DUPLICATES_LAST,        // keep the last row of each LABEL
+    DUPLICATES_MERGE        // fill the empty cells of the first row from the later rows
+};
+
+/**
+    translates a --duplicates= policy name
+    @param name is error, first, last or merge
+    @return the policy, or -1 if the name is not recognized
+*/
+int duplicates_policy(const char *name);
+
+/**
+    finds the rows that repeat a LABEL, through a hash index on LABEL, and
+    reports each one with the row it repeats. Unless every row is kept,
+    the duplicates are then removed from the label records and from the
+    spreadsheet rows, which must still be in row order, and
+    spreadsheet_row_number is reduced to match.
+    @param header contains the resolved column headings
+    @param labels is the array of label records, in row order
+    @param policy is the duplicates policy
+    @return the number of duplicate rows, or -1 if the policy is
+    DUPLICATES_ERROR and there are duplicates, or memory ran out
+*/
+int duplicates_resolve(const Sheet_header *header, Label_record *labels, int policy);
+
+/**
+    reports a row that repeats a LABEL
+    @param label is the LABEL
+    @param record is the record number of the row
+    @param first is the record number of the first row of the LABEL
+*/
+void duplicates_report(const char *label, int record, int first);
+
+/**
+    reports the records that repeat a LABEL in records sorted by LABEL, as
+    the cached records of a spreadsheet are, so that a run from the cache
+    reports what the run that parsed the spreadsheet did. The records are
+    numbered in LABEL order, which is row order if the sheet was sorted.
+    @param labels is the array of label records, sorted by LABEL
+    @param rows is the number of rows, including the heading row
+    @return the number of records that repeat a LABEL
+*/
+int duplicates_replay(const Label_record *labels, int rows);
+
+#endif //STOIDOC_DUPLICATES_H
@@ -0,0 +1,170 @@
+/**
+ *  graphics.c
+ */
+#include "graphics.h"
+#include "memory.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the initial number of buckets of a name set, a power of two          */
+#define NAMES_INITIAL_CAP    1024
+
+/* FNV-1a 64-bit parameters                                              */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x00000100000001b3ULL
+
+/** an open addressing set of lower case file names                     */
+typedef struct {
+    char **names;
+    uint64_t *hashes;
+    size_t cap;
+    size_t count;
+} Name_set;
+
+/* the files of the graphics directory, and the graphics found missing   */
+static Name_set files = {0};
+static Name_set missing = {0};
+
+static char lower(char c) {
+    return (char) (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+/**
+    hashes a name without regard to case
+*/
+static uint64_t hash_name(const char *name) {
+    uint64_t hash = FNV_OFFSET;
+    for (; *name; name++) {
+        hash ^= (unsigned char) lower(*name);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static bool same_name(const char *stored, const char *name) {
+    for (; *stored && lower(*name) == *stored; stored++, name++);
+    return *stored == '\0' && *name == '\0';
+}
+
+/**
+    finds the bucket of a name: the bucket holding it, or the empty bucket
+    it would go into
+*/
+static size_t find_bucket(const Name_set *set, const char *name, uint64_t hash) {
+    size_t mask = set->cap - 1;
+    size_t i = hash & mask;
+
+    while (set->names[i] != NULL && (set->hashes[i] != hash || !same_name(set->names[i], name)))
+        i = (i + 1) & mask;
+    return i;
+}
+
+/**
+    doubles the number of buckets of a set
+    @return 0 if successful, -1 otherwise
+*/
+static int grow(Name_set *set) {
+    size_t cap = set->cap ? 2 * set->cap : NAMES_INITIAL_CAP;
+    Name_set grown = {(char **) calloc(cap, sizeof(char *)), (uint64_t *) calloc(cap, sizeof(uint64_t)),
+                      cap, set->count};
+
+    if (grown.names == NULL || grown.hashes == NULL) {
+        free(grown.names);
+        free(grown.hashes);
+        return -1;
+    }
+    for (size_t i = 0; i < set->cap; i++) {
+        if (set->names[i] != NULL) {
+            size_t j = set->hashes[i] & (cap - 1);
+            while (grown.names[j] != NULL)
+                j = (j + 1) & (cap - 1);
+            grown.names[j] = set->names[i];
+            grown.hashes[j] = set->hashes[i];
+        }
+    }
+    free(set->names);
+    free(set->hashes);
+    memory_charge(MEM_LOOKUP, (long long) ((cap - set->cap) * (sizeof(char *) + sizeof(uint64_t))));
+    *set = grown;
+    return 0;
+}
+
+/**
+    adds a name to a set, keeping the load factor at most one half
+    @return 1 if the name was added, 0 if it was there already, -1 on error
+*/
+static int add_name(Name_set *set, const char *name) {
+    if (2 * (set->count + 1) > set->cap && grow(set) != 0)
+        return -1;
+
+    uint64_t hash = hash_name(name);
+    size_t i = find_bucket(set, name, hash);
+    if (set->names[i] != NULL)
+        return 0;
+
+    size_t length = strlen(name);
+    if ((set->names[i] = (char *) malloc(length + 1)) == NULL)
+        return -1;
+    memory_charge(MEM_LOOKUP, (long long) (length + 1));
+    for (size_t c = 0; c <= length; c++)
+        set->names[i][c] = lower(name[c]);
+    set->hashes[i] = hash;
+    set->count++;
+    return 1;
+}
+
+static bool has_name(const Name_set *set, const char *name) {
+    return set->count > 0 && set->names[find_bucket(set, name, hash_name(name))] != NULL;
+}
+
+static void free_names(Name_set *set) {
+    for (size_t i = 0; i < set->cap; i++) {
+        if (set->names[i] != NULL)
+            memory_charge(MEM_LOOKUP, -(long long) (strlen(set->names[i]) + 1));
+        free(set->names[i]);
+    }
+    memory_charge(MEM_LOOKUP, -(long long) (set->cap * (sizeof(char *) + sizeof(uint64_t))));
+    free(set->names);
+    free(set->hashes);
+    *set = (Name_set) {0};
+}
+
+int graphics_index(const char *directory) {
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+
+    if (dir == NULL)
+        return -1;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (add_name(&files, entry->d_name) == -1) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+    return (int) files.count;
+}
+
+bool graphics_exists(const char *name) {
+    return has_name(&files, name);
+}
+
+void graphics_verify(const char *name, int record) {
+    if (!graphics_exists(name) && add_name(&missing, name) == 1)
+        printf("Graphic \"%s\" in record %d is not in the graphics directory.\n", name, record);
+}
+
+int graphics_missing(void) {
+    return (int) missing.count;
+}
+
+void graphics_release(void) {
+    free_names(&files);
+    free_names(&missing);
+}
@@ -0,0 +1,49 @@
+/**
+    @file graphics.h
+    Together with graphics.c, this component is responsible for checking
+    that the graphics an IDoc refers to exist. The graphics directory is
+    read once into a set of file names, so each check is a lookup rather
+    than a file system call.
+*/
+
+#ifndef STOIDOC_GRAPHICS_H
+#define STOIDOC_GRAPHICS_H
+
+#include <stdbool.h>
+
+/**
+    reads the names of the files in the graphics directory. Names are
+    compared without regard to case, as on the file shares graphics are
+    kept on.
+    @param directory is the graphics directory
+    @return the number of files found, or -1 if the directory could not be read
+*/
+int graphics_index(const char *directory);
+
+/**
+    returns true if the graphics directory holds a file
+    @param name is the file name
+    @return true if the file exists
+*/
+bool graphics_exists(const char *name);
+
+/**
+    checks that a graphic referenced by a record exists, reporting each
+    missing graphic the first time it is referenced
+    @param name is the graphic name
+    @param record is the record number being processed
+*/
+void graphics_verify(const char *name, int record);
+
+/**
+    returns the number of different graphics found missing so far
+    @return the number of missing graphics
+*/
+int graphics_missing(void);
+
+/**
+    forgets the graphics directory and the graphics found missing
+*/
+void graphics_release(void);
+
+#endif //STOIDOC_GRAPHICS_H
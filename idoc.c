@@ -4,18 +4,33 @@
  *  idoc file.
  */
 #include <ctype.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "idoc.h"
 #include "label.h"
 #include "strl.h"
 #include "lookup.h"
-
-/* end of line new line character                                        */
-#define LF '\n'
+#include "compress.h"
+#include "reader.h"
+#include "pipeline.h"
+#include "labeldata.h"
+#include "cache.h"
+#include "text.h"
+#include "tails.h"
+#include "graphics.h"
+#include "mapout.h"
+#include "uring.h"
+#include "memory.h"
+#include "duplicates.h"
+#include "watch.h"
+#include "suggest.h"
 
 /* length of '_idoc (stoidoc 2.0)->txt' extension                        */
 #define FILE_EXT_LEN   36
@@ -39,6 +54,16 @@
 /* maximum length for a path                                             */
 #define MAX_PATH       260
 
+/* size of the blocks the IDoc file is written to standard output in     */
+#define STDOUT_BLOCK   (1024 * 1024)
+
+/* the name input files are given on standard input                      */
+#define STDIN_NAME     "stdin"
+
+
+/* the ways a characteristic record tail is rendered (see tails.h)       */
+#define TAIL_INFO       0
+#define TAIL_GRAPHIC    1
 
 /* normal graphics folder path                                           */
 #define GRAPHICS_PATH  "T:\\MEDICAL\\NA\\RTP\\TEAM CENTER\\TEMPLATES\\GRAPHICS\\"
@@ -49,6 +74,9 @@ char alt_graphics_path[MAX_PATH] = {0};
 /* determine the graphics path at run time                               */
 bool alt_path = false;
 
+// whether the graphics referenced are checked against the graphics directory (--verify-graphics)
+bool verify_graphics = false;
+
 /* whether or not to include non-SAP fields in IDoc                      */
 bool non_SAP_fields = false;
 
@@ -61,44 +89,6 @@ int spreadsheet_cap = 0;
 /* tracks the actual number of label rows in the spreadsheet             */
 int spreadsheet_row_number = 0;
 
-/* global variable to track the idoc sequence number                     */
-int sequence_number = 1;
-
-char prev_material[MED] = {0};
-
-/** a global struct variable of IDoc sequence numbers                    */
-struct control_numbers {
-    char ctrl_num[8];
-    int matl_seq_number;
-    int labl_seq_number;
-    int tdline_seq_number;
-    int char_seq_number;
-};
-
-/** defining the struct variable as a new type for convenience           */
-typedef struct control_numbers Ctrl;
-
-/**
-    Returns true (non-zero) if character-string parameter represents
-    a signed or unsigned floating-point number. Otherwise returns
-    false (zero).
-    @param str is the numeric string value to evaluate
-    @return true if str is a number, false otherwise
- */
-int isNumeric(const char *str) {
-
-    if (str == NULL || str[0] == '\0')
-        return 0;
-
-    int i = 0;
-    while (str[i] != '\0')
-        if (isdigit(str[i]) == 0)
-            return 0;
-        else
-            i++;
-    return 1;
-}
-
 /**
     Returns true (non-zero) if character-string parameter contains any
     spaces. Otherwise returns false (zero).
@@ -165,7 +155,7 @@ bool check_lookup_array() {
     @param needle is the search term
     @return the corresponding SAP lookup value, or null if not found
 */
-char *sap_lookup(char *needle) {
+char *sap_lookup(const char *needle) {
 
     int start = 0;
     int end = lookupsize - 1;
@@ -199,39 +189,34 @@ char *sap_lookup(char *needle) {
     allocating memory to hold the rows as needed. All CRLF and LF are
     replaced with null characters to delimit the end of the spreadsheet
     row / string. Rows containing just tab characters are ignored.
+    Reading stops at the first row whose label records would no longer
+    fit in the --max-memory budget, or once the rows can not be held.
     @param fp points to the input file
+    @return 0 if the whole spreadsheet was read, -1 if it does not fit
 */
-void read_spreadsheet(FILE *fp) {
+int read_spreadsheet(FILE *fp) {
 
-    char c;
-    char buffer[MAX_COLUMNS];
-    bool line_not_empty = false;
-    int i = 0;
+    char *row;
 
-    while ((c = (char) fgetc(fp)) != EOF) {
-        if (c == LF) {
-            //check if preceded by "##" - in that case do nothing
-            if ((i > 1) && buffer[i - 1] != '#' || buffer[i - 2] != '#') {
-                buffer[i] = '\0';
-                if (line_not_empty) {
-                    if (spreadsheet_row_number >= spreadsheet_cap) {
-                        spreadsheet_expand();
-                    }
-                    spreadsheet[spreadsheet_row_number] =
-                            (char *) malloc(i * sizeof(char) + 2);
-                    strlcpy(spreadsheet[spreadsheet_row_number], buffer, MAX_COLUMNS);
-                    spreadsheet_row_number++;
-                }
-                i = 0;
-                line_not_empty = false;
-            }
-        } else {
-            buffer[i++] = c;
-            if (c != '\t')
-                if (c != '\r')
-                    line_not_empty = true;
+    for (;;) {
+        // the array grows before a row is read, so that no row is lost if it can not
+        if (spreadsheet_row_number >= spreadsheet_cap) {
+            int cap = spreadsheet_cap;
+            if (spreadsheet_expand() != 0)
+                return -1;
+            memory_charge(MEM_ROWS, (long long) (spreadsheet_cap - cap) * (long long) sizeof(char *));
         }
+        if ((row = read_row(fp)) == NULL)
+            break;
+        spreadsheet[spreadsheet_row_number] = row;
+        spreadsheet_row_number++;
+        memory_charge(MEM_ROWS, (long long) strlen(row) + 1);
+
+        // a label record is allocated for every row once the sheet is read
+        if (!memory_fits((long long) spreadsheet_row_number * (long long) sizeof(Label_record)))
+            return -1;
     }
+    return 0;
 }
 
 /**
@@ -244,54 +229,84 @@ void print_spaces(FILE *fpout, int n) {
         fprintf(fpout, " ");
 }
 
+/**
+    renders the graphic path field of a record: the graphics path and the
+    graphic name, padded to 255 characters
+    @param dest receives the field
+    @param size is the size of dest
+    @param graphic is the name of the graphic to append to the path
+    @param idoc contains the record being printed
+    @return the length of the field
+*/
+static size_t render_graphic_path(char *dest, size_t size, const char *graphic, const Ctrl *idoc) {
+    const char *path = alt_path ? alt_graphics_path : GRAPHICS_PATH;
+    size_t graphic_length = strnlen(graphic, MED + 1);
+    int n = 255 - ((int) strlen(path) + (int) graphic_length) + text_utf8_extra(path) + text_utf8_extra(graphic);
+
+    // placeholders such as "Nothing" or "Yes" are not files
+    if (verify_graphics && !idoc->replay && graphic_length > 4 &&
+        strcasecmp(graphic + graphic_length - 4, ".tif") == 0)
+        graphics_verify(graphic, idoc->record);
+
+    int length = snprintf(dest, size, "%s%s%*s", path, graphic, n > 0 ? n : 0, "");
+    return (size_t) length < size ? (size_t) length : size - 1;
+}
+
 /**
     prints a portion of an idoc field record based on the passed parameter
     @param fpout points to the output file
     @param graphic is the name of the graphic to append to the path and to print
+    @param idoc contains the record being printed
 */
-void print_graphic_path(FILE *fpout, char *graphic) {
-    int n = 0;
-    if (alt_path) {
-        fprintf(fpout, "%s", alt_graphics_path);
-        n = 255 - ((int) strlen(alt_graphics_path) + (int) strnlen(graphic, MED + 1));
-    } else {
-        fprintf(fpout, "%s", GRAPHICS_PATH);
-        n = 255 - ((int) strlen(GRAPHICS_PATH) + (int) strnlen(graphic, MED + 1));
-    }
-    fprintf(fpout, "%s", graphic);
+void print_graphic_path(FILE *fpout, const char *graphic, const Ctrl *idoc) {
+    char field[TAIL_MAX];
 
-    for (int i = 0; i < n; i++)
-        fprintf(fpout, " ");
+    fwrite(field, 1, render_graphic_path(field, sizeof(field), graphic, idoc), fpout);
 }
 
 /**
-    prints a specified number of spaces to a file stream
+    prints the prefix of a characteristic record, up to its column name
     @param fpout points to the output file
-    @param ctrl_num
-    @param n is the number of spaces to print
+    @param idoc contains the control and sequence numbers
 */
-void print_Z2BTLC01000(FILE *fpout, char *ctrl_num, int char_seq_number) {
-    fprintf(fpout, "Z2BTLC01000");
-    print_spaces(fpout, 19);
-    fprintf(fpout, "500000000000");
+void print_Z2BTLC01000(FILE *fpout, Ctrl *idoc) {
     // cols 22-29 - 7 digit control number?
-    fprintf(fpout, "%s", ctrl_num);
-    fprintf(fpout, "%06d", sequence_number++);
-    fprintf(fpout, "%06d", char_seq_number);
-    fprintf(fpout, CHAR_REC);
+    fprintf(fpout, "Z2BTLC01000%19s500000000000%s%06d%06d" CHAR_REC, "", idoc->ctrl_num, idoc->sequence_number++,
+            idoc->char_seq_number);
 }
 
-void print_info_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl *idoc) {
-
-    if (strlen(col_value) > 0) {
-        if (equals_no(col_value) > 0) // it is blank, but should be treated as "NO"
-            strcpy(col_value, "NO");
+/**
+    print a passed column-field that holds an informational value
+    @param fpout points to the output file
+    @param col_name is the column name from the spreadsheet
+    @param col_value is the contents of the labels cell beneath the column name
+    @param cell is the cell class of col_value
+    @param idoc contains the sequence and control numbers struct
+ */
+void print_info_column_header(FILE *fpout, const char *col_name, const char *col_value, int cell, Ctrl *idoc) {
+
+    if (cell != CELL_EMPTY) {
+        if (cell == CELL_N) // it is blank, but should be treated as "NO"
+            col_value = "NO";
+
+        // the rest of the record is rendered once per column and value
+        char tail[TAIL_MAX];
+        size_t length;
+        const char *rendered = tails_find(TAIL_INFO, cell, col_name, col_value, &length);
+
+        if (rendered == NULL) {
+            // the fields are padded to their widths in characters
+            int extra = text_utf8_extra(col_value);
+            int n = snprintf(tail, sizeof(tail), "%-30s%-*s%-*s\n", col_name, 30 + extra, col_value, 255 + extra,
+                             col_value);
+            length = (size_t) n < sizeof(tail) ? (size_t) n : sizeof(tail) - 1;
+            if (!idoc->replay)
+                tails_store(TAIL_INFO, cell, col_name, col_value, tail, length);
+            rendered = tail;
+        }
 
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        fprintf(fpout, "%-30s", col_name);
-        fprintf(fpout, "%-30s", col_value);
-        fprintf(fpout, "%-255s", col_value);
-        fprintf(fpout, "\n");
+        print_Z2BTLC01000(fpout, idoc);
+        fwrite(rendered, 1, length, fpout);
     }
 }
 
@@ -302,41 +317,67 @@ void print_info_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl
     @param fpout points to the output file
     @param col_name is the column name from the spreadsheet
     @param col_value is the contents of the labels cell beneath the column name
-    @param default_yes is the graphic item to print if col_value is a Y / Yes
+    @param cell is the cell class of col_value
+    @param default_yes is the graphic item to print if col_value is a Y / Yes; the same for every
+           record of a column
     @param idoc contains the sequence and control numbers struct
  */
-void print_graphic_column_header(FILE *fpout, char *col_name, char *col_value, char *default_yes, Ctrl *idoc) {
-
-    char cell_contents[MED];
-    strncpy(cell_contents, col_value, MED - 1);
+void print_graphic_column_header(FILE *fpout, const char *col_name, const char *col_value, int cell,
+                                 const char *default_yes, Ctrl *idoc) {
 
     // only print a record if the cell_contents contains a value
-    if (strlen(cell_contents) > 0) {
-
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        fprintf(fpout, "%-30s", col_name);
-        fprintf(fpout, "%-30s", col_value);
-
-        if (equals_yes(col_value)) {
-            strncpy(cell_contents, default_yes, MED - 1);
-            print_graphic_path(fpout, cell_contents);
-        } else if (equals_no(col_value)) {
-            print_graphic_path(fpout, "blank-01.tif");
-        } else {
+    if (cell != CELL_EMPTY) {
+
+        // the rest of the record is rendered once per column and value
+        char tail[TAIL_MAX];
+        size_t length;
+        const char *rendered = tails_find(TAIL_GRAPHIC, cell, col_name, col_value, &length);
+
+        if (rendered == NULL) {
+            // room for the ".tif" suffix
+            char cell_contents[MED + 4] = {0};
+            char graphic_name[LRG + 4] = {0};
+            const char *graphic;
+
+            strncpy(cell_contents, col_value, MED - 1);
+
+            if (cell == CELL_Y) {
+                strncpy(cell_contents, default_yes, MED - 1);
+                graphic = cell_contents;
+            } else if (cell == CELL_N) {
+                graphic = "blank-01.tif";
+            } else {
 
-            // graphic_name will be converted to its SAP lookup value from the static lookup array
-            // or, if there is no lookup value, graphic_name itself will be used
-            char *gnp = sap_lookup(col_value);
+                // graphic_name will be converted to its SAP lookup value from the static lookup array
+                // or, if there is no lookup value, graphic_name itself will be used
+                char *gnp = sap_lookup(col_value);
 
-            if (gnp) {
-                char graphic_name[LRG];
-                strncpy(graphic_name, gnp, LRG - 1);
-                print_graphic_path(fpout, strcat(graphic_name, ".tif"));
-            } else {
-                print_graphic_path(fpout, strcat(cell_contents, ".tif"));
+                if (gnp) {
+                    strncpy(graphic_name, gnp, LRG - 1);
+                    graphic = strcat(graphic_name, ".tif");
+                } else {
+                    graphic = strcat(cell_contents, ".tif");
+
+                    // a value close to a lookup key is more likely a misspelling than a file name
+                    bool first;
+                    const char *suggestion = idoc->replay ? NULL : suggest_lookup(col_value, &first);
+                    if (suggestion != NULL && first)
+                        printf("Graphic value \"%s\" in record %d is not a lookup value and is printed as \"%s\". "
+                               "Did you mean %s?\n", col_value, idoc->record, graphic, suggestion);
+                }
             }
+
+            int n = snprintf(tail, sizeof(tail), "%-30s%-*s", col_name, 30 + text_utf8_extra(col_value), col_value);
+            length = (size_t) n < sizeof(tail) - 1 ? (size_t) n : sizeof(tail) - 2;
+            length += render_graphic_path(tail + length, sizeof(tail) - 1 - length, graphic, idoc);
+            tail[length++] = '\n';
+            if (!idoc->replay)
+                tails_store(TAIL_GRAPHIC, cell, col_name, col_value, tail, length);
+            rendered = tail;
         }
-        fprintf(fpout, "\n");
+
+        print_Z2BTLC01000(fpout, idoc);
+        fwrite(rendered, 1, length, fpout);
     }
 }
 
@@ -350,113 +391,31 @@ void print_graphic_column_header(FILE *fpout, char *col_name, char *col_value, c
     @param default_yes is the graphic item to print if col_value is a Y / Yes
     @param idoc contains the sequence and control numbers struct
  */
-void print_blank_graphic_column_header(FILE *fpout, char *col_name, char *col_value, Ctrl *idoc) {
+void print_blank_graphic_column_header(FILE *fpout, const char *col_name, char *col_value, Ctrl *idoc) {
 
     char cell_contents[MED];
     strncpy(cell_contents, col_value, MED - 1);
 
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+    print_Z2BTLC01000(fpout, idoc);
     fprintf(fpout, "%-30s", col_name);
-    fprintf(fpout, "%-30s", col_value);
+    fprintf(fpout, "%-*s", 30 + text_utf8_extra(col_value), col_value);
 
-    print_graphic_path(fpout, "");
+    print_graphic_path(fpout, "", idoc);
     fprintf(fpout, "\n");
 }
 
-void print_info_lookup_column_header(FILE *fpout, char *col_name, char *col_value, char *lookup, Ctrl *idoc) {
+void print_info_lookup_column_header(FILE *fpout, const char *col_name, char *col_value, char *lookup, Ctrl *idoc) {
 
     char cell_contents[MED];
     strncpy(cell_contents, col_value, MED - 1);
 
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+    print_Z2BTLC01000(fpout, idoc);
     fprintf(fpout, "%-30s", col_name);
-    fprintf(fpout, "%-30s", col_value);
+    fprintf(fpout, "%-*s", 30 + text_utf8_extra(col_value), col_value);
     fprintf(fpout, "%-255s", lookup);
     fprintf(fpout, "\n");
 }
 
-/**
-    print a passed column-field that is in the special GRAPHICS01 - GRAPHICS14 category and is defined as
-    boolean in the Label_record. It contains a "Y" or a "N." If "Y," print the hard-coded value associated with
-    the graphic and a .tif suffix. Otherwise, print a "blank-01.tif" record.
-    @param fpout points to the output file
-    @param col_name is the column header
-    @param value is the boolean value of the column-field
-    @param graphic_name is the graphic to print if the boolean is true
-    @param idoc is the struct that tracks the control numbers
- */
-void print_graphic0x_record(FILE *fpout, int *g_cnt, char *graphic_name, unsigned int value, Ctrl *idoc) {
-
-    if (value == 2) {
-        char g_cnt_str[03];
-        char graphic[10] = "GRAPHIC0";
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        sprintf(g_cnt_str, "%d", (*g_cnt)++);
-        fprintf(fpout, "%-30s", strcat(graphic, g_cnt_str));
-        fprintf(fpout, "%-30s", "Y");
-        print_graphic_path(fpout, graphic_name);
-        fprintf(fpout, "\n");
-    } else if (value == 3) {
-        char g_cnt_str[03];
-        char graphic[10] = "GRAPHIC0";
-        char F_graphic_name[LRG] = "F_";
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        sprintf(g_cnt_str, "%d", (*g_cnt)++);
-        fprintf(fpout, "%-30s", strcat(graphic, g_cnt_str));
-        fprintf(fpout, "%-30s", "F_Y");
-        strcat(F_graphic_name, graphic_name);
-        print_graphic_path(fpout, F_graphic_name);
-        fprintf(fpout, "\n");
-    } else if (value == 4) {
-        char g_cnt_str[03];
-        char graphic[10] = "GRAPHIC0";
-        char ISO_graphic_name[LRG] = "ISO_";
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        sprintf(g_cnt_str, "%d", (*g_cnt)++);
-        fprintf(fpout, "%-30s", strcat(graphic, g_cnt_str));
-        fprintf(fpout, "%-30s", "ISO_Y");
-        strcat(ISO_graphic_name, graphic_name);
-        print_graphic_path(fpout, ISO_graphic_name);
-        fprintf(fpout, "\n");
-    }
-}
-
-/**
-    print a passed column-field that is defined as boolean in the Label_record. It contains a "Y" or a "N."
-    If "Y," print the hard-coded value associated with the graphic and a .tif suffix. Otherwise, print a
-    "blank-01.tif" record.
-    @param fpout points to the output file
-    @param col_name is the column header
-    @param value is the boolean value of the column-field
-    @param graphic_name is the graphic to print if the boolean is true
-    @param idoc is the struct that tracks the control numbers
- */
-void print_boolean_record(FILE *fpout, char *col_name, int value, char *graphic_name, Ctrl *idoc) {
-    if (value) {
-        print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
-        fprintf(fpout, "%-30s", col_name);
-
-        if (value == 2) {
-            fprintf(fpout, "%-30s", "Y");
-            print_graphic_path(fpout, graphic_name);
-        } else if (value == 3) {
-            char F_graphic_name[LRG] = "F_";
-            strcat(F_graphic_name, graphic_name);
-            fprintf(fpout, "%-30s", "F_Y");
-            print_graphic_path(fpout, F_graphic_name);
-        } else if (value == 4) {
-            char ISO_graphic_name[LRG] = "ISO_";
-            strcat(ISO_graphic_name, graphic_name);
-            fprintf(fpout, "%-30s", "ISO_Y");
-            print_graphic_path(fpout, ISO_graphic_name);
-        } else {
-            fprintf(fpout, "%-30s", "N");
-            print_graphic_path(fpout, "blank-01.tif");
-        }
-        fprintf(fpout, "\n");
-    }
-}
-
 /**
     print a passed column-field that is defined as boolean in the Label_record. It contains a "Y" or a "N."
     If "Y," print just a "Yes." Otherwise, print just a "No."
@@ -466,17 +425,17 @@ void print_boolean_record(FILE *fpout, char *col_name, int value, char *graphic_
     @param graphic_name is the graphic to print if the boolean is true
     @param idoc is the struct that tracks the control numbers
  */
-void print_boolean_column_header(FILE *fpout, char *col_name, bool value, Ctrl *idoc) {
+void print_boolean_column_header(FILE *fpout, const char *col_name, bool value, Ctrl *idoc) {
 
-    print_Z2BTLC01000(fpout, idoc->ctrl_num, idoc->char_seq_number);
+    print_Z2BTLC01000(fpout, idoc);
     fprintf(fpout, "%-30s", col_name);
 
     if (value) {
         fprintf(fpout, "%-30s", "Y");
-        print_graphic_path(fpout, "Yes");
+        print_graphic_path(fpout, "Yes", idoc);
     } else {
         fprintf(fpout, "%-30s", "N");
-        print_graphic_path(fpout, "No");
+        print_graphic_path(fpout, "No", idoc);
     }
     fprintf(fpout, "\n");
 }
@@ -515,126 +474,161 @@ int print_control_record(FILE *fpout, Ctrl *idoc) {
 }
 
 /**
-    prints the remaining IDoc records based on the number
-    of label records.
-    @param fpout points to the output file
-    @param labels is the array of label records
-    @param cols is the column header struct that contains all of the column names
+    checks the length, check digit and prefixes of a numeric GTIN,
+    reporting any problem found
+    @param value is the GTIN
+    @param decoded is the GTIN as decoded while parsing
     @param record is the record number being processed
-    @param idoc is a Ctrl structure containing sequence numbers
-    @return true if a label_idoc_record was printed successfully
 */
-int print_label_idoc_records(FILE *fpout, Label_record *labels, int record, Ctrl *idoc) {
+void check_gtin(const char *value, const Gtin_value *decoded, int record) {
 
-    // Print the records for a given IDOC (labels[record])
+    // the GTIN length and value were decoded while parsing
+    long long gtin = decoded->number;
+    int gtin_ctry_prefix = 0;
+    int gtin_cpny_prefix = 0;
 
-    // temporary variables to examine field contents
-    char graphic_val[MED];
-    //char prev_material[MED] = {0};
+    // 14-digit GTIN - verify the checkDigit
+    if (decoded->digits == GTIN_13 + 1) {
+        if (gtin % 10 != checkDigit(&gtin)) {
+            printf("Invalid GTIN check digit \"%s\" in record %d.\n", value, record);
+        }
+        gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
+        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
 
-    // MATERIAL record (optional)
-    // (this is skipped if the previous material record is the same)
-    if ((strlen(labels[record].material) > 0)) {
+    } else if (decoded->digits == GTIN_13) {
+        gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
+        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
+    } else {
+        printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", value, record);
+        // without a valid length the prefixes cannot be isolated
+        gtin = 0;
+    }
 
-        // check whether it's a new material
-        if (strcmp(prev_material, labels[record].material) != 0) {
+    // verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
+    // verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
+    if ((gtin_ctry_prefix > 4) || ((gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112)))
+        printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
+}
 
-            // new material record
-            fprintf(fpout, "Z2BTMH01000");
-            print_spaces(fpout, 19);
-            fprintf(fpout, "500000000000");
-            // cols 22-29 - 7 digit control number?
-            fprintf(fpout, "%s", idoc->ctrl_num);
-            fprintf(fpout, "%06d", sequence_number);
+/**
+    returns the text field of the record being printed that a step prints
+*/
+static char *step_field(const Emit_context *ctx, const Emit_step *step) {
+    return (char *) ctx->label + step->offset;
+}
 
-            // every NEW material number carries over the sequence_number
-            idoc->matl_seq_number = sequence_number - 1;
-            idoc->labl_seq_number = sequence_number;
-            fprintf(fpout, "%06d", idoc->matl_seq_number);
-            sequence_number++;
+/**
+    returns the cell class of the text field a step prints
+*/
+static int step_cell(const Emit_context *ctx, const Emit_step *step) {
+    return ctx->label->cells[step->slot];
+}
 
-            fprintf(fpout, MATERIAL_REC);
-            fprintf(fpout, "%-18s", labels[record].material);
-            fprintf(fpout, "\n");
-            strlcpy(prev_material, labels[record].material, LRG);
-        }
-    }
-    // LABEL record (required). If the contents of .label are not "LBL", program aborts.
-    char graphic_val_shrt[4] = {0};
-    strncpy(graphic_val_shrt, labels[record].label, 3);
-    if (strcmp(graphic_val_shrt, "LBL") != 0) {
-        printf("The first 3 characters of the record are not \"LBL\", record %d.\n", record);
-        return 0;
-    } else {
-        fprintf(fpout, "Z2BTLH01000");
+/**
+    MATERIAL record (optional)
+    (this is skipped if the previous material record is the same)
+*/
+static int emit_material(Emit_context *ctx, const Emit_step *step) {
+    (void) step;
+    FILE *fpout = ctx->fpout;
+    Label_record *label = ctx->label;
+    Ctrl *idoc = ctx->idoc;
+
+    // check whether it's a new material
+    if ((strlen(label->material) > 0) && (strcmp(idoc->prev_material, label->material) != 0)) {
+
+        // new material record
+        fprintf(fpout, "Z2BTMH01000");
         print_spaces(fpout, 19);
         fprintf(fpout, "500000000000");
-
         // cols 22-29 - 7 digit control number?
         fprintf(fpout, "%s", idoc->ctrl_num);
-        fprintf(fpout, "%06d", sequence_number);
-        fprintf(fpout, "%06d", idoc->labl_seq_number);
-        idoc->tdline_seq_number = sequence_number;
-        idoc->char_seq_number = sequence_number;
-        sequence_number++;
-        fprintf(fpout, LABEL_REC);
-        fprintf(fpout, "%-18s", labels[record].label);
+        fprintf(fpout, "%06d", idoc->sequence_number);
+
+        // every NEW material number carries over the sequence_number
+        idoc->matl_seq_number = idoc->sequence_number - 1;
+        idoc->labl_seq_number = idoc->sequence_number;
+        fprintf(fpout, "%06d", idoc->matl_seq_number);
+        idoc->sequence_number++;
+
+        fprintf(fpout, MATERIAL_REC);
+        fprintf(fpout, "%-18s", label->material);
         fprintf(fpout, "\n");
+        strlcpy(idoc->prev_material, label->material, LRG);
     }
+    return 1;
+}
 
-    // TDLINE record(s) (optional) - repeat as many times as there are "##"
+/**
+    LABEL record (required). If the contents of .label are not "LBL", program aborts.
+*/
+static int emit_label(Emit_context *ctx, const Emit_step *step) {
+    (void) step;
+    FILE *fpout = ctx->fpout;
+    Ctrl *idoc = ctx->idoc;
+
+    if (strncmp(ctx->label->label, "LBL", 3) != 0) {
+        if (!idoc->replay)
+            printf("The first 3 characters of the record are not \"LBL\", record %d.\n", ctx->record);
+        return 0;
+    }
 
-    memcpy(graphic_val, labels[record].tdline, 4);
+    fprintf(fpout, "Z2BTLH01000");
+    print_spaces(fpout, 19);
+    fprintf(fpout, "500000000000");
 
-    if ((strlen(graphic_val) > 0) &&
-        (strcasecmp(graphic_val, "n/a") != 0) &&
-        (equals_no(graphic_val) != 1)) {
+    // cols 22-29 - 7 digit control number?
+    fprintf(fpout, "%s", idoc->ctrl_num);
+    fprintf(fpout, "%06d", idoc->sequence_number);
+    fprintf(fpout, "%06d", idoc->labl_seq_number);
+    idoc->tdline_seq_number = idoc->sequence_number;
+    idoc->char_seq_number = idoc->sequence_number;
+    idoc->sequence_number++;
+    fprintf(fpout, LABEL_REC);
+    fprintf(fpout, "%-18s", ctx->label->label);
+    fprintf(fpout, "\n");
+    return 1;
+}
 
-        //* get the first token *//*
-        int tdline_count = 0;
+/**
+    TDLINE record(s) (optional) - repeat as many times as there are "##"
+*/
+static int emit_tdline(Emit_context *ctx, const Emit_step *step) {
+    FILE *fpout = ctx->fpout;
+    Label_record *label = ctx->label;
+    Ctrl *idoc = ctx->idoc;
 
-        char *token = labels[record].tdline;
+    int cell = step_cell(ctx, step);
 
-        //check for and remove any leading...
-        if (token[0] == '\"')
-            memmove(token, token + 1, (int) strlen(token));
+    if (label->tdline && cell != CELL_EMPTY && cell != CELL_NA && cell != CELL_N) {
 
-        // ...and/or trailing quotes
-        if (token[(int) strlen(token) - 1] == '\"')
-            token[(int) strlen(token) - 1] = '\0';
+        int tdline_count = 0;
+        const char *cursor, *end;
+        Text_slice line;
 
-        // and convert all instances of double quotes to single quotes
-        char *a;
-        while (a = strstr(token, "\"\""))
-            memmove(a, a + 1, (int) strlen(a));
+        // the lines are slices of the cell text; nothing is moved or rewritten
+        text_unquote_bounds(label->tdline, &cursor, &end);
 
-        while (strlen(token) > 0) {
+        while (text_next_line(&cursor, end, &line)) {
             fprintf(fpout, "Z2BTTX01000");
             print_spaces(fpout, 19);
             fprintf(fpout, "500000000000");
             // cols 22-29 - 7 digit control number?
             fprintf(fpout, "%s", idoc->ctrl_num);
-            fprintf(fpout, "%06d", sequence_number++);
+            fprintf(fpout, "%06d", idoc->sequence_number++);
             fprintf(fpout, "%06d", idoc->tdline_seq_number);
             fprintf(fpout, TDLINE_REC);
             fprintf(fpout, "GRUNE  ENMATERIAL  ");
-            fprintf(fpout, "%s", labels[record].label);
+            fprintf(fpout, "%s", label->label);
             print_spaces(fpout, TDLINE_INDENT);
 
-            char *dpos = strstr(token, "##");
-
-            if (dpos != NULL) {
-                *dpos = '\0';
-                fprintf(fpout, "%s", token);
+            text_print(fpout, &line);
+            if (line.line_break) {
                 fprintf(fpout, "##");
-                print_spaces(fpout, 70 - (int) (strlen(token) - 2));
+                print_spaces(fpout, 72 - line.length);
+            } else
+                print_spaces(fpout, 74 - line.length);
 
-                // get the next segment of label record, after the "##"
-                token = dpos + (int) strlen("##");
-            } else {
-                fprintf(fpout, "%-74s", token);
-                token[0] = '\0';
-            }
             if (tdline_count == 0)
                 fprintf(fpout, "*");
             else
@@ -643,510 +637,466 @@ int print_label_idoc_records(FILE *fpout, Label_record *labels, int record, Ctrl
             fprintf(fpout, "\n");
         }
     }
+    return 1;
+}
 
-    // TEMPLATENUMBER record (required)
-    if (labels[record].template) {
-        print_info_column_header(fpout, "TEMPLATENUMBER", labels[record].template, idoc);
-    } else {
-        printf("Missing template number in record %d. Aborting.\n", record);
-        return 0;
-    }
+/**
+    a record holding the cell value (TEMPLATENUMBER, LTNUMBER, IPN and the non-SAP fields)
+*/
+static int emit_info(Emit_context *ctx, const Emit_step *step) {
+    print_info_column_header(ctx->fpout, step->name, step_field(ctx, step), step_cell(ctx, step), ctx->idoc);
+    return 1;
+}
 
-    // REVISION record (optional)
-    if (labels[record].revision) {
-        int rev = 0;
-        if ((sscanf(labels[record].revision, "R%d", &rev) == 1) && rev >= 0 && rev <= 99) {
-            print_info_column_header(fpout, "REVISION", labels[record].revision, idoc);
-        } else
-            printf("Invalid revision value \"%s\" in record %d. REVISION record skipped.\n",
-                   labels[record].revision, record);
-    }
+/**
+    a record holding the cell value, skipped if the value is a "N" (QUANTITY)
+*/
+static int emit_info_unless_no(Emit_context *ctx, const Emit_step *step) {
+    int cell = step_cell(ctx, step);
+
+    if (cell != CELL_N)
+        print_info_column_header(ctx->fpout, step->name, step_field(ctx, step), cell, ctx->idoc);
+    return 1;
+}
+
+/**
+    REVISION record (optional)
+*/
+static int emit_revision(Emit_context *ctx, const Emit_step *step) {
+    char *revision = ctx->label->revision;
+
+    if (ctx->label->revision_number >= 0) {
+        print_info_column_header(ctx->fpout, "REVISION", revision, step_cell(ctx, step), ctx->idoc);
+    } else if (!ctx->idoc->replay)
+        printf("Invalid revision value \"%s\" in record %d. REVISION record skipped.\n",
+               revision, ctx->record);
+    return 1;
+}
 
-    // LABEL_RELEASE_DATE record
-    if (strlen(labels[record].release) > 0) {
-        int input = 0;
+/**
+    LABEL_RELEASE_DATE record
+*/
+static int emit_release(Emit_context *ctx, const Emit_step *step) {
+    char *release = ctx->label->release;
+
+    if (step_cell(ctx, step) != CELL_EMPTY) {
+        int input = ctx->label->release_date;
         int first_two = 0;
         int second_two = 0;
-        sscanf(labels[record].release, "%d", &input);
         first_two = input / 100;
         second_two = input % 100;
         if (((first_two >= 20) || ((first_two > 0) && (first_two < 13))) &&
             ((second_two > 19) || ((second_two > 0) && (second_two < 13)))) {
-            print_info_column_header(fpout, "LABEL_RELEASE_DATE", labels[record].release, idoc);
-        } else
+            print_info_column_header(ctx->fpout, "LABEL_RELEASE_DATE", release, step_cell(ctx, step), ctx->idoc);
+        } else if (!ctx->idoc->replay)
             printf("Invalid release date value \"%s\" in record %d. LABEL_RELEASE_DATE record skipped.\n",
-                   labels[record].release, record);
+                   release, ctx->record);
     }
+    return 1;
+}
 
-// SIZE record (optional)
-    memcpy(graphic_val, labels[record]
-            .size, MED);
-
-    if ((
-                strlen(labels[record]
-                               .size) > 0) && (!
-            equals_no(graphic_val)
-        )) {
-        char *token = labels[record].size;
-
-//check for and remove any leading...
-        if (token[0] == '\"')
-            memmove(token, token
-                           + 1,
-                    strlen(token)
-            );
-
-// ...and/or trailing quotes
-        if (token[
-                    strlen(token)
-                    - 1] == '\"')
-            token[
-                    strlen(token)
-                    - 1] = '\0';
-
-// and convert all instances of double quotes to single quotes
-        char *a;
-        int diff;
-        while ((
-                       a = strstr(token, "\"\"")
-               ) != NULL) {
-            diff = (int) (a - token);
-            memmove(token
-                    + diff, token + diff + 1,
-                    strlen(token)
-                    - 1);
-        }
+/**
+    SIZE record (optional)
+*/
+static int emit_size(Emit_context *ctx, const Emit_step *step) {
+
+    int cell = step_cell(ctx, step);
+
+    if (cell != CELL_EMPTY && cell != CELL_N) {
+        char size[MED];
+        // the unquoted value is classified again: a quoted "N" prints as a "NO"
+        size_t length = text_unquote(size, sizeof(size), ctx->label->size, true);
 
-// size name will be checked against its SAP lookup value.
-// just in case there's a matching entry...
-        char *gnp = sap_lookup(labels[record].size);
+        // size name will be checked against its SAP lookup value.
+        // just in case there's a matching entry...
+        char *gnp = sap_lookup(size);
         if (gnp != NULL)
-            print_info_lookup_column_header(fpout,
-                                            "SIZE", labels[record].size, gnp, idoc);
+            print_info_lookup_column_header(ctx->fpout, "SIZE", size, gnp, ctx->idoc);
         else
-            print_info_column_header(fpout,
-                                     "SIZE", labels[record].size, idoc);
+            print_info_column_header(ctx->fpout, "SIZE", size, classify_cell(size, length), ctx->idoc);
     }
+    return 1;
+}
 
-/** LEVEL record (optional) */
-
-    if ((
-                strlen(labels[record]
-                               .level) > 0) && (!
-            equals_no(labels[record]
-                              .level))) {
+/**
+    LEVEL record (optional)
+*/
+static int emit_level(Emit_context *ctx, const Emit_step *step) {
+    char *level = ctx->label->level;
+    int cell = step_cell(ctx, step);
+
+    if (cell != CELL_EMPTY && cell != CELL_N) {
+
+        // level name will be checked against its SAP lookup value.
+        // if it's not in there, it'll be reported as such (but will not be changed).
+        char *gnp = sap_lookup(level);
+        if (gnp == NULL && !ctx->idoc->replay) {
+            bool first;
+            const char *suggestion = suggest_lookup(level, &first);
+
+            if (suggestion != NULL)
+                printf("Level value \"%s\" in record %d is not a standard LEVEL value. Did you mean %s?\n",
+                       level, ctx->record, suggestion);
+            else
+                printf("Level value \"%s\" in record %d is not a standard LEVEL value. Please check it.\n",
+                       level, ctx->record);
+        }
 
-// level name will be checked against its SAP lookup value.
-// if it's not in there, it'll be reported as such. Otherwise, the  (but will not be changed).
-        char *gnp = sap_lookup(labels[record].level);
-        if (gnp == NULL)
-            printf("Level value \"%s\" in record %d is not a standard LEVEL value. Please check it.\n",
-                   labels[record].level, record);
+        print_info_lookup_column_header(ctx->fpout, "LEVEL", level, gnp, ctx->idoc);
+    }
+    return 1;
+}
 
-        print_info_lookup_column_header(fpout,
-                                        "LEVEL", labels[record].level, gnp, idoc);
+/**
+    BARCODETEXT and GTIN records (optional): the GTIN is verified before printing
+*/
+static int emit_gtin_info(Emit_context *ctx, const Emit_step *step) {
+    char *value = step_field(ctx, step);
+    int cell = step_cell(ctx, step);
+    const Gtin_value *decoded = &ctx->label->gtins[step->offset == offsetof(Label_record, gtin) ? GTIN_GTIN
+                                                                                                : GTIN_BARCODETEXT];
+
+    if (cell != CELL_EMPTY && cell != CELL_N) {
+        if (!ctx->idoc->replay) {
+            if (decoded->digits > 0)
+                check_gtin(value, decoded, ctx->record);
+            else
+                // GTIN non-numeric so we'll report that it's non-numeric before printing.
+                printf("Nonnumeric GTIN \"%s\" in record %d. \n", value, ctx->record);
+        }
 
+        print_info_column_header(ctx->fpout, step->name, value, cell, ctx->idoc);
     }
+    return 1;
+}
+
+/** a symbol column: its IDoc name and its Y, F_Y and ISO_Y graphics   */
+typedef struct {
+    const char *name;
+    const char *graphics[3];
+} Symbol_desc;
+
+#define GRAPHICS(g)     {g, "F_" g, "ISO_" g}
+
+static const Symbol_desc symbol_descs[SYM_COUNT] = {
+        [SYM_CAUTION]           = {"CAUTION",          GRAPHICS("Caution.tif")},
+        [SYM_CONSULTIFU]        = {"CONSULTIFU",       GRAPHICS("ConsultIFU.tif")},
+        [SYM_LATEX]             = {"CONTAINSLATEX",    GRAPHICS("Latex.tif")},
+        [SYM_DONOTUSEDAMAGED]   = {"DONOTUSEDAM",      GRAPHICS("DoNotUsePakDam.tif")},
+        [SYM_LATEXFREE]         = {"LATEXFREE",        GRAPHICS("Latex Free.tif")},
+        [SYM_MANINBOX]          = {"MANINBOX",         GRAPHICS("ManInBox.tif")},
+        [SYM_NORESTERILIZE]     = {"NORESTERILE",      GRAPHICS("DoNotRe-sterilize.tif")},
+        [SYM_NONSTERILE]        = {"NONSTERILE",       GRAPHICS("Non-sterile.tif")},
+        [SYM_PVCFREE]           = {"PVCFREE",          GRAPHICS("PVC_Free.tif")},
+        [SYM_REUSABLE]          = {"REUSABLE",         GRAPHICS("Reusable.tif")},
+        [SYM_SINGLEUSEONLY]     = {"SINGLEUSE",        GRAPHICS("SINGLEUSE.tif")},
+        [SYM_SINGLEPATIENTUSE]  = {"SINGLEPATIENTUSE", GRAPHICS("SinglePatienUse.tif")},
+        [SYM_ELECTROIFU]        = {"ELECTROSURIFU",    GRAPHICS("ElectroSurIFU.tif")},
+        [SYM_KEEPDRY]           = {"KEEPDRY",          GRAPHICS("KeepDry.tif")},
+        [SYM_ECREP]             = {"ECREP",            GRAPHICS("EC REP_2.tif")},
+        [SYM_EXPDATE]           = {"EXPDATE",          GRAPHICS("Expiration Date.tif")},
+        [SYM_KEEPAWAYHEAT]      = {"KEEPAWAYHEAT",     GRAPHICS("KeepAwayHeat.tif")},
+        [SYM_LOTGRAPHIC]        = {"LOTGRAPHIC",       GRAPHICS("Lot.tif")},
+        [SYM_MANUFACTURER]      = {"MANUFACTURER",     GRAPHICS("Manufacturer.tif")},
+        [SYM_MFGDATE]           = {"MFGDATE",          GRAPHICS("DateofManufacture.tif")},
+        [SYM_PHTDEHP]           = {"PHTDEHP",          GRAPHICS("PHT-DEHP.tif")},
+        [SYM_PHTBBP]            = {"PHTBBP",           GRAPHICS("PHT-BBP.tif")},
+        [SYM_PHTDINP]           = {"PHTDINP",          GRAPHICS("PHT-DINP.tif")},
+        [SYM_REFNUMBER]         = {"REFNUMBER",        GRAPHICS("REF.tif")},
+        [SYM_REF]               = {"REF",              GRAPHICS("REF.tif")},
+        [SYM_RXONLY]            = {"RXONLY",           GRAPHICS("Rx_only_2.tif")},
+        [SYM_SERIAL]            = {"SERIAL",           GRAPHICS("Serial Number.tif")},
+        [SYM_TFXLOGO]           = {"TFXLOGO",          GRAPHICS("TeleflexMedical.tif")},
+        [SYM_SIZELOGO]          = {"SIZELOGO",         {NULL, NULL, NULL}}
+};
+
+/* the symbol values, as returned by get_symbol                          */
+static const char *const symbol_value_names[] = {"", "N", "Y", "F_Y", "ISO_Y"};
+
+/* the names of the GRAPHIC0x records, numbered the way SAP expects them  */
+static const char *const graphic_names[SYM_KEEPDRY + 1] = {
+        "GRAPHIC01", "GRAPHIC02", "GRAPHIC03", "GRAPHIC04", "GRAPHIC05", "GRAPHIC06", "GRAPHIC07",
+        "GRAPHIC08", "GRAPHIC09", "GRAPHIC010", "GRAPHIC011", "GRAPHIC012", "GRAPHIC013", "GRAPHIC014"
+};
 
-/** QUANTITY record (optional) */
-    if ((labels[record].quantity) && (!
-            equals_no(labels[record]
-                              .quantity))) {
-        print_info_column_header(fpout,
-                                 "QUANTITY", labels[record].quantity, idoc);
+/**
+    GRAPHIC01 - GRAPHIC14 Fields (optional)
+    A record is printed for every graphic symbol that is "Y," "F_Y" or "ISO_Y," numbered in symbol order.
+*/
+static int emit_graphics(Emit_context *ctx, const Emit_step *step) {
+    uint64_t values = ctx->label->symbol_values;
+
+    // a lane is printed if its value is Y, F_Y or ISO_Y (1, 2 or 3), and only set lanes are nonzero
+    uint64_t lanes = (values | (values >> 1)) & step->lanes;
+    int count = __builtin_popcountll(lanes);
+
+    for (int g = 0; g < count; g++, lanes &= lanes - 1) {
+        int symbol = __builtin_ctzll(lanes) / 2;
+        unsigned int value = (unsigned int) (values >> (2 * symbol)) & 3;
+
+        print_Z2BTLC01000(ctx->fpout, ctx->idoc);
+        fprintf(ctx->fpout, "%-30s", graphic_names[g]);
+        fprintf(ctx->fpout, "%-30s", symbol_value_names[value + 1]);
+        print_graphic_path(ctx->fpout, symbol_descs[symbol].graphics[value - 1], ctx->idoc);
+        fprintf(ctx->fpout, "\n");
     }
+    return 1;
+}
 
-/** BARCODETEXT record (optional) */
-    char *endptr;
-    if ((
-                strlen(labels[record]
-                               .barcodetext) > 0) && (!
-            equals_no(labels[record]
-                              .barcodetext))) {
-
-        if (
-                isNumeric(labels[record]
-                                  .barcodetext)) {
-
-// convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].barcodetext, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
-
-// 14-digit GTIN - verify the checkDigit
-            if ((
-                    strlen(labels[record]
-                                   .barcodetext) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].barcodetext, record);
-                }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-            } else if (
-                    strlen(labels[record]
-                                   .barcodetext) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].barcodetext, record);
-            }
+/**
+    BARCODE1 record (optional)
+*/
+static int emit_barcode1(Emit_context *ctx, const Emit_step *step) {
+    char *barcode1 = ctx->label->barcode1;
 
-// verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-// verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
+    int cell = step_cell(ctx, step);
 
-// GTIN non-numeric so we'll report that it's non-numeric before printing.
-        } else {
-            printf("Nonnumeric GTIN \"%s\" in record %d. \n", labels[record].barcodetext, record);
-        }
-        print_info_column_header(fpout,
-                                 "BARCODETEXT", labels[record].barcodetext, idoc);
+    if (cell != CELL_N) {
+        if (ctx->label->gtins[GTIN_BARCODE1].digits > 0 && !ctx->idoc->replay)
+            check_gtin(barcode1, &ctx->label->gtins[GTIN_BARCODE1], ctx->record);
+        print_graphic_column_header(ctx->fpout, "BARCODE1", barcode1, cell, "Nothing", ctx->idoc);
     }
+    return 1;
+}
 
-/** GTIN record (optional) - this is a non-SAP field that prints only if [-n] flag is present at runtime */
-    if (labels[record].gtin) {
-        if (non_SAP_fields) {
-            char gtin_digit1[2] = {0};
-            strncpy(gtin_digit1, labels[record]
-                    .gtin, 1);
-
-            if ((
-                        strlen(labels[record]
-                                       .gtin) > 0) && (!
-                    equals_no(labels[record]
-                                      .gtin))) {
-
-                if (
-                        isNumeric(labels[record]
-                                          .gtin)) {
-
-// convert string to long long integer to verify GTIN length and check digit
-                    long long gtin = strtoll(labels[record].gtin, &endptr, 10);
-                    int gtin_ctry_prefix;
-                    int gtin_cpny_prefix;
-
-// 14-digit GTIN - verify the checkDigit
-                    if ((
-                            strlen(labels[record]
-                                           .gtin) == GTIN_13 + 1)) {
-                        if (gtin % 10 != checkDigit(&gtin)) {
-                            printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].gtin, record);
-                        }
-                        gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-                    } else if (
-                            strlen(labels[record]
-                                           .gtin) == GTIN_13) {
-                        gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                        gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-                    } else {
-                        printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].gtin,
-                               record);
-                    }
-
-// verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-// verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-                    if ((gtin_ctry_prefix > 4) ||
-                        (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                        printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
-
-// GTIN non-numeric so we'll report that it's non-numeric before printing.
-                } else {
-                    printf("Nonnumeric GTIN \"%s\" in record %d. \n", labels[record].gtin, record);
-                }
-                print_info_column_header(fpout,
-                                         "GTIN", labels[record].gtin, idoc);
-            }
-        }
+/**
+    GS1 record (optional)
+*/
+static int emit_gs1(Emit_context *ctx, const Emit_step *step) {
+    char *gs1 = ctx->label->gs1;
+
+    int cell = step_cell(ctx, step);
+
+    if (cell != CELL_N) {
+        if (ctx->label->gtins[GTIN_GS1].digits > 0 && !ctx->idoc->replay)
+            check_gtin(gs1, &ctx->label->gtins[GTIN_GS1], ctx->record);
+
+        // if the GS1 field contains any spaces, just print the column heading, but no value
+        if (containsSpaces(gs1))
+            print_blank_graphic_column_header(ctx->fpout, "GS1", gs1, ctx->idoc);
+        else
+            print_graphic_column_header(ctx->fpout, "GS1", gs1, cell, "GS1", ctx->idoc);
     }
-// LTNUMBER record (optional)
-    if (labels[record].ltnumber) {
-        print_info_column_header(fpout,
-                                 "LTNUMBER", labels[record].ltnumber, idoc);
+    return 1;
+}
+
+/**
+    the symbol records, ECREP - TFXLOGO: a record for every symbol with a value, printing its graphic for a
+    "Y," "F_Y" or "ISO_Y" and a "blank-01.tif" for a "N"
+*/
+static int emit_booleans(Emit_context *ctx, const Emit_step *step) {
+    uint64_t values = ctx->label->symbol_values;
+
+    for (uint32_t set = ctx->label->symbols_set & step->symbols; set != 0; set &= set - 1) {
+        int symbol = __builtin_ctz(set);
+        unsigned int value = (unsigned int) (values >> (2 * symbol)) & 3;
+
+        print_Z2BTLC01000(ctx->fpout, ctx->idoc);
+        fprintf(ctx->fpout, "%-30s", symbol_descs[symbol].name);
+        fprintf(ctx->fpout, "%-30s", symbol_value_names[value + 1]);
+        print_graphic_path(ctx->fpout, value ? symbol_descs[symbol].graphics[value - 1] : "blank-01.tif", ctx->idoc);
+        fprintf(ctx->fpout, "\n");
     }
+    return 1;
+}
 
-// IPN record (optional) - - this is a non-SAP field that prints only if [-n] flag is present at runtime */
-    if (non_SAP_fields)
-        if (labels[record].ipn) {
-            print_info_column_header(fpout,
-                                     "IPN", labels[record].ipn, idoc);
-        }
+/**
+    SIZELOGO record: always printed, as a "Y" or a "N"
+*/
+static int emit_sizelogo(Emit_context *ctx, const Emit_step *step) {
+    print_boolean_column_header(ctx->fpout, step->name, get_symbol(ctx->label, SYM_SIZELOGO), ctx->idoc);
+    return 1;
+}
 
-//
-// GRAPHIC01 - GRAPHIC14 Fields (optional)
-// If the cell value is "Y" or "YES', a corresponding record is printed.
-//
-    int g_cnt = 1;
-    char temp_graphic[MED];
-
-    print_graphic0x_record(fpout,
-                           &g_cnt, "Caution.tif", labels[record].caution, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "ConsultIFU.tif", labels[record].consultifu, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "Latex.tif", labels[record].latex, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "DoNotUsePakDam.tif", labels[record].donotusedamaged, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "Latex Free.tif", labels[record].latexfree, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "ManInBox.tif", labels[record].maninbox, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "DoNotRe-sterilize.tif", labels[record].noresterilize, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "Non-sterile.tif", labels[record].nonsterile, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "PVC_Free.tif", labels[record].pvcfree, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "Reusable.tif", labels[record].reusable, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "SINGLEUSE.tif", labels[record].singleuseonly, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "SinglePatienUse.tif", labels[record].singlepatientuse, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "ElectroSurIFU.tif", labels[record].electroifu, idoc);
-    print_graphic0x_record(fpout,
-                           &g_cnt, "KeepDry.tif", labels[record].keepdry, idoc);
-
-/*print_graphic0x_record(fpout, &g_cnt, "Caution.tif", labels[record].caution, idoc);
-print_graphic0x_record(fpout, &g_cnt, "ConsultIFU.tif", labels[record].consultifu, idoc);
-print_graphic0x_record(fpout, &g_cnt, "Latex.tif", labels[record].latex, idoc);
-print_graphic0x_record(fpout, &g_cnt, "DoNotUsePakDam.tif", labels[record].donotusedamaged, idoc);
-print_graphic0x_record(fpout, &g_cnt, "F_LatexFree3.tif", labels[record].latexfree, idoc);
-print_graphic0x_record(fpout, &g_cnt, "ManInBox.tif", labels[record].maninbox, idoc);
-print_graphic0x_record(fpout, &g_cnt, "DoNotRe-sterilize.tif", labels[record].noresterilize, idoc);
-print_graphic0x_record(fpout, &g_cnt, "Non-sterile.tif", labels[record].nonsterile, idoc);
-print_graphic0x_record(fpout, &g_cnt, "PVC_Free.tif", labels[record].pvcfree, idoc);
-print_graphic0x_record(fpout, &g_cnt, "REUSABLE.tif", labels[record].reusable, idoc);
-print_graphic0x_record(fpout, &g_cnt, "SINGLEUSE.tif", labels[record].singleuseonly, idoc);
-print_graphic0x_record(fpout, &g_cnt, "SINGLEPATIENUSE.tif", labels[record].singlepatientuse, idoc);
-print_graphic0x_record(fpout, &g_cnt, "ElectroSurIFU.tif", labels[record].electroifu, idoc);
-print_graphic0x_record(fpout, &g_cnt, "KeepDry.tif", labels[record].keepdry, idoc);*/
-//
-// END of GRAPHIC01 - GRAPHIC14 Fields (optional)
-//
-
-/** BARCODE1 record (optional) */
-    if ((labels[record].barcode1) && (!
-            equals_no(labels[record]
-                              .barcode1))) {
-
-        if (
-                isNumeric(labels[record]
-                                  .barcode1)) {
-
-// convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].barcode1, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
-
-// 14-digit GTIN - verify the checkDigit
-            if ((
-                    strlen(labels[record]
-                                   .barcode1) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].barcode1, record);
-                }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-            } else if (
-                    strlen(labels[record]
-                                   .barcode1) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].barcode1, record);
-            }
+/**
+    a record holding the cell value and the path of its graphic
+*/
+static int emit_graphic_column(Emit_context *ctx, const Emit_step *step) {
+    print_graphic_column_header(ctx->fpout, step->name, step_field(ctx, step), step_cell(ctx, step),
+                                step->graphic, ctx->idoc);
+    return 1;
+}
 
-// verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-// verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
-        }
-        print_graphic_column_header(fpout,
-                                    "BARCODE1", labels[record].barcode1, "Nothing", idoc);
+/**
+    DESCRIPTION record (optional), without its surrounding quotes
+*/
+static int emit_description(Emit_context *ctx, const Emit_step *step) {
+    (void) step;
+    char description[MED];
+
+    size_t length = text_unquote(description, sizeof(description), ctx->label->description, false);
+    print_info_column_header(ctx->fpout, "DESCRIPTION", description, classify_cell(description, length), ctx->idoc);
+    return 1;
+}
+
+/* the slot and lanes are filled in by build_emit_plan                   */
+#define TEXT(f)         offsetof(Label_record, f), 0, 0, 0
+#define SYMBOL(mask)    0, mask, 0, 0
+
+/** every record the IDoc can hold for a label, in the order they are printed */
+static const Emit_step emit_steps[] = {
+        {emit_material,       EMIT_FIELD,             "MATERIAL",           TEXT(material),           NULL},
+        {emit_label,          EMIT_ALWAYS,            "LABEL",              TEXT(label),              NULL},
+        {emit_tdline,         EMIT_FIELD,             "TDLINE",             TEXT(tdline),             NULL},
+        {emit_info,           EMIT_FIELD,             "TEMPLATENUMBER",     TEXT(template),           NULL},
+        // an invalid (or missing) revision is reported for every record
+        {emit_revision,       EMIT_ALWAYS,            "REVISION",           TEXT(revision),           NULL},
+        {emit_release,        EMIT_FIELD,             "LABEL_RELEASE_DATE", TEXT(release),            NULL},
+        {emit_size,           EMIT_FIELD,             "SIZE",               TEXT(size),               NULL},
+        {emit_level,          EMIT_FIELD,             "LEVEL",              TEXT(level),              NULL},
+        {emit_info_unless_no, EMIT_FIELD,             "QUANTITY",           TEXT(quantity),           NULL},
+        {emit_gtin_info,      EMIT_FIELD,             "BARCODETEXT",        TEXT(barcodetext),        NULL},
+        {emit_gtin_info,      EMIT_FIELD | EMIT_NON_SAP, "GTIN",            TEXT(gtin),               NULL},
+        {emit_info,           EMIT_FIELD,             "LTNUMBER",           TEXT(ltnumber),           NULL},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "IPN",             TEXT(ipn),                NULL},
+        {emit_graphics,       EMIT_SYMBOL,            "GRAPHIC",            SYMBOL(GRAPHIC_SYMBOLS),  NULL},
+        {emit_barcode1,       EMIT_FIELD,             "BARCODE1",           TEXT(barcode1),           NULL},
+        {emit_gs1,            EMIT_FIELD,             "GS1",                TEXT(gs1),                NULL},
+        {emit_booleans,       EMIT_SYMBOL,            "ECREP",              SYMBOL(BOOLEAN_SYMBOLS),  NULL},
+        // printed as a "N" even when the sheet has no SIZELOGO column
+        {emit_sizelogo,       EMIT_ALWAYS | EMIT_SYMBOL, "SIZELOGO",        SYMBOL(1u << SYM_SIZELOGO), NULL},
+        {emit_graphic_column, EMIT_FIELD,             "ADDRESS",            TEXT(address),            "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "CAUTIONSTATE",       TEXT(cautionstatement),   "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "CE0120",             TEXT(cemark),             "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "COOSTATE",           TEXT(coostate),           "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "DISTRIBUTEDBY",      TEXT(distby),             "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "ECREPADDRESS",       TEXT(ecrepaddress),       "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "FLGRAPHIC",          TEXT(flgraphic),          "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LABELGRAPH1",        TEXT(labelgraph1),        "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LABELGRAPH2",        TEXT(labelgraph2),        "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LATEXSTATEMENT",     TEXT(latexstatement),     "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LOGO1",              TEXT(logo1),              "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LOGO2",              TEXT(logo2),              "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LOGO3",              TEXT(logo3),              "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LOGO4",              TEXT(logo4),              "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "LOGO5",              TEXT(logo5),              "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MDR1",               TEXT(mdr1),               "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MDR2",               TEXT(mdr2),               "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MDR3",               TEXT(mdr3),               "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MDR4",               TEXT(mdr4),               "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MDR5",               TEXT(mdr5),               "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "MANUFACTUREDBY",     TEXT(manufacturedby),     "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "PATENTSTA",          TEXT(patentstatement),    "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "STERILESTA",         TEXT(sterilitystatement), "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "STERILITYTYPE",      TEXT(sterilitytype),      "blank-01.txt"},
+        {emit_graphic_column, EMIT_FIELD,             "TEMPRANGE",          TEXT(temprange),          "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "VERSION",            TEXT(version),            "Nothing"},
+        {emit_graphic_column, EMIT_FIELD,             "INSERTGRAPHIC",      TEXT(insertgraphic),      "yes"},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "OLDLABEL",        TEXT(oldlabel),           NULL},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "OLDTEMPLATE",     TEXT(oldtemplate),        NULL},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "PREVLABEL",       TEXT(prevlabel),          NULL},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "PREVTEMPLATE",    TEXT(prevtemplate),       NULL},
+        {emit_info,           EMIT_FIELD | EMIT_NON_SAP, "BOMLEVEL",        TEXT(bomlevel),           NULL},
+        {emit_description,    EMIT_FIELD | EMIT_NON_SAP, "DESCRIPTION",     TEXT(description),        NULL}
+};
+
+/** number of steps a plan can hold                                     */
+static const int emit_steps_size = sizeof(emit_steps) / sizeof(emit_steps[0]);
+
+/**
+    returns the symbols the columns of a sheet fill
+    @param header contains the resolved column headings, or NULL for all symbols
+    @return a bit per symbol
+*/
+static uint32_t header_symbols(const Sheet_header *header) {
+    uint32_t symbols = 0;
+
+    if (header == NULL)
+        return (1u << SYM_COUNT) - 1;
+    for (int c = 0; c < header->count; c++) {
+        const Column_def *def = header->columns[c];
+        if (def != NULL && (def->kind == FIELD_SYMBOL || def->kind == FIELD_YES))
+            symbols |= 1u << def->symbol;
     }
+    return symbols;
+}
 
-/** GS1 record (optional) */
+/**
+    returns true if a column of the sheet fills the text field a step prints
+*/
+static bool field_present(const Sheet_header *header, const Emit_step *step) {
+    for (int c = 0; c < header->count; c++) {
+        const Column_def *def = header->columns[c];
+        if (def != NULL && def->kind != FIELD_SYMBOL && def->kind != FIELD_YES && def->offset == step->offset)
+            return true;
+    }
+    return false;
+}
 
-    if ((labels[record].gs1) && (!
-            equals_no(labels[record]
-                              .gs1))) {
+int build_emit_plan(Emit_plan *plan, const Sheet_header *header) {
+    uint32_t symbols = header_symbols(header);
 
-        char *endptr;
-        if (
-                isNumeric(labels[record]
-                                  .gs1)) {
+    plan->count = 0;
 
-// convert string to long long integer to verify GTIN length and check digit
-            long long gtin = strtoll(labels[record].gs1, &endptr, 10);
-            int gtin_ctry_prefix;
-            int gtin_cpny_prefix;
+    for (int s = 0; s < emit_steps_size; s++) {
+        const Emit_step *step = &emit_steps[s];
+        Emit_step *planned = &plan->steps[plan->count];
 
-// 14-digit GTIN - verify the checkDigit
-            if ((
-                    strlen(labels[record]
-                                   .gs1) == GTIN_13 + 1)) {
-                if (gtin % 10 != checkDigit(&gtin)) {
-                    printf("Invalid GTIN check digit \"%s\" in record %d.\n", labels[record].gs1, record);
-                }
-                gtin_ctry_prefix = (int) (gtin / GTIN_14_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_14_DIGIT)) / GTIN_14_CPNY_DIVISOR);
-
-            } else if (
-                    strlen(labels[record]
-                                   .gs1) == GTIN_13) {
-                gtin_ctry_prefix = (int) (gtin / GTIN_13_DIGIT);
-                gtin_cpny_prefix = (int) ((gtin - (gtin_ctry_prefix * GTIN_13_DIGIT)) / GTIN_13_CPNY_DIVISOR);
-            } else {
-                printf("Invalid GTIN check digit or length \"%s\" in record %d.\n", labels[record].gs1, record);
-            }
+        if ((step->presence & EMIT_NON_SAP) && !non_SAP_fields)
+            continue;
+        *planned = *step;
 
-// verify GTIN prefixes if it's nonzero (otherwise it's just a placeholder)
-// verify the GTIN prefixes (country: 0, 1, 2, 3, company: 4026704 or 5060112)
-            if ((gtin_ctry_prefix > 4) || (gtin != 0) && (gtin_cpny_prefix != 4026704 && gtin_cpny_prefix != 5060112))
-                printf("Invalid GTIN prefix \"%d\" in record %d.\n", gtin_cpny_prefix, record);
+        if (step->presence & EMIT_SYMBOL) {
+            // a symbol step only prints the symbols the sheet has
+            planned->symbols &= symbols;
+            if (planned->symbols == 0 && !(step->presence & EMIT_ALWAYS))
+                continue;
+            planned->lanes = 0;
+            for (uint32_t set = planned->symbols; set != 0; set &= set - 1)
+                planned->lanes |= (uint64_t) 1 << (2 * __builtin_ctz(set));
+        } else {
+            if (!(step->presence & EMIT_ALWAYS) && header != NULL && !field_present(header, step))
+                continue;
+            // the cell class of a text field is kept in the slot of its first column heading
+            planned->slot = field_slot(step->offset);
         }
-
-// if the GS1 field contains any spaces, just print the column heading, but no value
-        if (
-                containsSpaces(labels[record]
-                                       .gs1))
-            print_blank_graphic_column_header(fpout,
-                                              "GS1", labels[record].gs1, idoc);
-        else
-            print_graphic_column_header(fpout,
-                                        "GS1", labels[record].gs1, "GS1", idoc);
+        plan->count++;
     }
+    return plan->count;
+}
 
-    print_boolean_record(fpout,
-                         "ECREP", labels[record].ecrep, "EC REP_2.tif", idoc);
-    print_boolean_record(fpout,
-                         "EXPDATE", labels[record].expdate, "Expiration Date.tif", idoc);
-    print_boolean_record(fpout,
-                         "KEEPAWAYHEAT", labels[record].keepawayheat, "KeepAwayHeat.tif", idoc);
-    print_boolean_record(fpout,
-                         "LOTGRAPHIC", labels[record].lotgraphic, "Lot.tif", idoc);
-    print_boolean_record(fpout,
-                         "MANUFACTURER", labels[record].manufacturer, "Manufacturer.tif", idoc);
-    print_boolean_record(fpout,
-                         "MFGDATE", labels[record].mfgdate, "DateofManufacture.tif", idoc);
-    print_boolean_record(fpout,
-                         "PHTDEHP", labels[record].phtdehp, "PHT-DEHP.tif", idoc);
-    print_boolean_record(fpout,
-                         "PHTBBP", labels[record].phtbbp, "PHT-BBP.tif", idoc);
-    print_boolean_record(fpout,
-                         "PHTDINP", labels[record].phtdinp, "PHT-DINP.tif", idoc);
-    print_boolean_record(fpout,
-                         "REFNUMBER", labels[record].refnumber, "REF.tif", idoc);
-    print_boolean_record(fpout,
-                         "REF", labels[record].ref, "REF.tif", idoc);
-    print_boolean_record(fpout,
-                         "RXONLY", labels[record].rxonly, "Rx_only_2.tif", idoc);
-    print_boolean_record(fpout,
-                         "SERIAL", labels[record].serial, "Serial Number.tif", idoc);
-    print_boolean_record(fpout,
-                         "TFXLOGO", labels[record].tfxlogo, "TeleflexMedical.tif", idoc);
-
-    print_boolean_column_header(fpout,
-                                "SIZELOGO", labels[record].sizelogo, idoc);
-
-    print_graphic_column_header(fpout,
-                                "ADDRESS", labels[record].address, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "CAUTIONSTATE", labels[record].cautionstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "CE0120", labels[record].cemark, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "COOSTATE", labels[record].coostate, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "DISTRIBUTEDBY", labels[record].distby, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "ECREPADDRESS", labels[record].ecrepaddress, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "FLGRAPHIC", labels[record].flgraphic, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LABELGRAPH1", labels[record].labelgraph1, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LABELGRAPH2", labels[record].labelgraph2, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LATEXSTATEMENT", labels[record].latexstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LOGO1", labels[record].logo1, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LOGO2", labels[record].logo2, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LOGO3", labels[record].logo3, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LOGO4", labels[record].logo4, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "LOGO5", labels[record].logo5, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MDR1", labels[record].mdr1, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MDR2", labels[record].mdr2, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MDR3", labels[record].mdr3, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MDR4", labels[record].mdr4, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MDR5", labels[record].mdr5, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "MANUFACTUREDBY", labels[record].manufacturedby, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "PATENTSTA", labels[record].patentstatement, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "STERILESTA", labels[record].sterilitystatement, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "STERILITYTYPE", labels[record].sterilitytype, "blank-01.txt", idoc);
-    print_graphic_column_header(fpout,
-                                "TEMPRANGE", labels[record].temprange, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "VERSION", labels[record].version, "Nothing", idoc);
-    print_graphic_column_header(fpout,
-                                "INSERTGRAPHIC", labels[record].insertgraphic, "yes", idoc);
-
-
-    if (non_SAP_fields) {
-        print_info_column_header(fpout,
-                                 "OLDLABEL", labels[record].oldlabel, idoc);
-        print_info_column_header(fpout,
-                                 "OLDTEMPLATE", labels[record].oldtemplate, idoc);
-        print_info_column_header(fpout,
-                                 "PREVLABEL", labels[record].prevlabel, idoc);
-        print_info_column_header(fpout,
-                                 "PREVTEMPLATE", labels[record].prevtemplate, idoc);
-        print_info_column_header(fpout,
-                                 "BOMLEVEL", labels[record].bomlevel, idoc);
-
-// DESCRIPTION record (optional)
-
-//check for and remove any leading...
-        if (labels[record].description[0] == '\"')
-            memmove(labels[record]
-                            .description, labels[record].description + 1,
-                    (int)
-                            strlen(labels[record]
-                                           .description));
-
-// ...and/or trailing quotes
-        if (labels[record].description[(int)
-                                               strlen(labels[record]
-                                                              .description) - 1] == '\"')
-            labels[record].description[(int)
-                                               strlen(labels[record]
-                                                              .description) - 1] = '\0';
-
-        print_info_column_header(fpout,
-                                 "DESCRIPTION", labels[record].description, idoc);
-    }
+int print_label_idoc_records(FILE *fpout, const Emit_plan *plan, Label_record *label, int record, Ctrl *idoc) {
+    Emit_context ctx = {fpout, label, record, idoc};
+
+    idoc->record = record;
+
+    // Print the records for a given IDOC (label), one step at a time
+    for (int s = 0; s < plan->count; s++)
+        if (!plan->steps[s].emit(&ctx, &plan->steps[s]))
+            return 0;
     return 1;
 }
 
+/**
+    moves standard output aside for the IDoc file: the program's messages
+    are sent to standard error from then on, so that nothing but the IDoc
+    file reaches standard output
+    @return a stream writing to standard output in large blocks, or NULL on error
+*/
+FILE *open_stdout_idoc(void) {
+    FILE *fp;
+    int fd;
+
+    fflush(stdout);
+    if ((fd = dup(STDOUT_FILENO)) == -1)
+        return NULL;
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, STDOUT_BLOCK);
+    return fp;
+}
+
+/**
+    prints the command line usage
+    @param program is the name the program was invoked with
+*/
+void print_usage(char *program) {
+    printf("usage: %s filename.txt|filename.xlsx|-|--watch DIR [PATH:<alternate graphics path>] [-n] [-L] [--compress=gzip|zstd] [--pipeline] [--cache] [--threads=N] [--verify-graphics] [--mmap] [--uring] [--fsync] [--stdout] [--max-memory=SIZE] [--group-material] [--duplicates=error|first|last|merge]\n",
+           program);
+}
+
 int main(int argc, char *argv[]) {
 
     // elapsed time
@@ -1163,7 +1113,51 @@ int main(int argc, char *argv[]) {
     // boolean to track whether "Label Data" -L flag is set
     bool label_data = false;
 
-    Ctrl idoc = {"2541435", 0, 1, 0, 0};
+    // compression method of the IDoc file (--compress=)
+    int compression = COMPRESS_NONE;
+
+    // stream a LABEL-sorted spreadsheet through the pipelined converter
+    bool pipeline = false;
+
+    // number of parser threads (--threads=), 0 to size them to the processors
+    int threads = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // keep the parsed labels in "<file>.cache" for the next run (--cache)
+    bool use_cache = false;
+
+    // print the IDoc file into a mapping of its final size, on several threads (--mmap)
+    bool use_mmap = false;
+
+    // write the IDoc file asynchronously through io_uring (--uring), fsyncing it on close (--fsync)
+    bool use_uring = false;
+    bool sync_output = false;
+
+    // the spreadsheet is read from standard input ("-"), the IDoc file written to standard output (--stdout)
+    bool from_stdin = false;
+    FILE *fp_stdout = NULL;
+
+    // memory budget of the buffered spreadsheet (--max-memory=), 0 for none
+    long long max_memory = 0;
+
+    // print the records grouped by MATERIAL, then LABEL (--group-material)
+    bool group_material = false;
+
+    // what is done with rows that repeat a LABEL (--duplicates=); they are reported either way
+    int duplicates = DUPLICATES_KEEP;
+
+    // rows read before the spreadsheet was found not to fit the budget
+    int buffered = 0;
+
+    // whether the labels were mapped from the cache file
+    bool cached = false;
+    Cache_key key;
+
+    // the resolved column headings, and the emission plan built from them
+    Sheet_header *header = (Sheet_header *) malloc(sizeof(Sheet_header));
+    Emit_plan *plan = (Emit_plan *) malloc(sizeof(Emit_plan));
+
+    Ctrl idoc = {"2541435", 0, 1, 0, 0, 0, 1, "", false};
 
     if (!check_lookup_array())
         return EXIT_FAILURE;
@@ -1173,96 +1167,367 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    FILE *fp, *fpout_idoc, *fpout_data;
+    FILE *fp, *fp_sheet, *fpout_idoc;
+
+    // the "Label Data" output files (-L)
+    Label_data *fpout_data = NULL;
 
-    if ((argc != 2) && (argc != 3) && (argc != 4)) {
-        printf("usage: %s filename.txt [PATH:<alternate graphics path>] [-n]\n", argv[0]);
+    if (argc < 2) {
+        print_usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    // check for optional command line parameter:
+    // check for optional command line parameters:
     // -PATH:  substitutes <alternate graphics path> for GRAPHICS_PATH
     // -n prints "non-standard" column names in the IDoc: GTIN, IPN, OLDLABEL, OLDTEMPLATE, DESCRIPTION, PREVLABEL and PREVTEMPLATE
-    // to do: -L creates a second "Label Data" output file
+    // --compress=gzip|zstd writes the IDoc through a streaming compressor
+    // --pipeline reads, parses and prints an already sorted spreadsheet concurrently
+    // --threads=N parses the spreadsheet on N threads
+    // --cache reuses the parsed labels of an unchanged spreadsheet from an earlier run
+    // -L writes the parsed label records to <file>_labeldata.csv and <file>_labeldata.bin
+    // --verify-graphics reports graphics that are not in the graphics directory
+    // --mmap sizes the IDoc file before printing its records into it on --threads=N threads
+    // --uring writes the IDoc file asynchronously, in blocks, while the records are printed
+    // --fsync flushes the --uring IDoc file to disk before it is closed
+    // --stdout writes the IDoc file to standard output and the messages to standard error
+    // --max-memory=SIZE streams a spreadsheet that would not fit in SIZE bytes (K, M or G suffix)
+    // --group-material orders the records by MATERIAL, then LABEL, to print fewer MATERIAL records
+    // --duplicates=error|first|last|merge aborts on, or removes, the rows that repeat a LABEL
+    // "-" as filename.txt reads the spreadsheet from standard input
+    // --watch DIR in place of filename.txt converts every spreadsheet dropped into DIR, on --threads=N workers
+
+    from_stdin = strcmp(argv[1], "-") == 0;
+
+    // the options follow the filename, or the watched folder
+    const char *watch_dir = NULL;
+    int first_option = 2;
+    if (strcmp(argv[1], "--watch") == 0) {
+        if (argc < 3) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        watch_dir = argv[2];
+        first_option = 3;
+    }
 
-    if (argc > 3)
-        if ((argv[3] != NULL) && (strncmpci(argv[3], "PATH:", 5) == 0)) {
-            alt_path = true;
-            // define alternate graphics path variable
-            char *p = argv[2] + strlen("PATH:");
-            strcpy(alt_graphics_path, p);
-            printf("Alternate graphics path selected:\n=> %s \n(run program without 'PATH:' flag to use default graphics path)\n\n", alt_graphics_path);
-        } else if ((argv[3] != NULL) && (strncmpci(argv[3], "-n", 2) == 0)) {
-            non_SAP_fields = true;
-            printf("Including non-SAP column headings in IDoc. Run program without '-n' flag to remove.\n");
+    // the messages of the options below must not end up in the IDoc file
+    for (int a = first_option; a < argc; a++)
+        if (strcmp(argv[a], "--stdout") == 0 && fp_stdout == NULL && (fp_stdout = open_stdout_idoc()) == NULL) {
+            printf("Could not write to standard output.\n");
+            return EXIT_FAILURE;
         }
-    if (argc > 2)
-        if ((argv[2] != NULL) && (strncmpci(argv[2], "PATH:", 5) == 0)) {
+
+    for (int a = first_option; a < argc; a++) {
+        if (strcmp(argv[a], "--pipeline") == 0) {
+            pipeline = true;
+        } else if (strncmp(argv[a], "--threads=", strlen("--threads=")) == 0) {
+            threads = atoi(argv[a] + strlen("--threads="));
+            if (threads < 1) {
+                printf("Invalid number of threads \"%s\".\n", argv[a] + strlen("--threads="));
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[a], "--cache") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[a], "--mmap") == 0) {
+            use_mmap = true;
+        } else if (strcmp(argv[a], "--uring") == 0) {
+            use_uring = true;
+        } else if (strcmp(argv[a], "--fsync") == 0) {
+            sync_output = true;
+        } else if (strncmp(argv[a], "--max-memory=", strlen("--max-memory=")) == 0) {
+            max_memory = memory_parse_size(argv[a] + strlen("--max-memory="));
+            if (max_memory == -1) {
+                printf("Invalid memory size \"%s\".\n", argv[a] + strlen("--max-memory="));
+                return EXIT_FAILURE;
+            }
+            memory_set_budget(max_memory);
+        } else if (strncmp(argv[a], "--duplicates=", strlen("--duplicates=")) == 0) {
+            duplicates = duplicates_policy(argv[a] + strlen("--duplicates="));
+            if (duplicates == -1) {
+                printf("Unknown duplicates policy \"%s\".\n", argv[a] + strlen("--duplicates="));
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[a], "--group-material") == 0) {
+            group_material = true;
+        } else if (strcmp(argv[a], "--stdout") == 0) {
+            // standard output was set aside above
+        } else if (strcmp(argv[a], "--verify-graphics") == 0) {
+            verify_graphics = true;
+        } else if (strncmp(argv[a], "--compress=", strlen("--compress=")) == 0) {
+            compression = compress_method(argv[a] + strlen("--compress="));
+            if (compression == -1) {
+                printf("Unknown compression method \"%s\".\n", argv[a] + strlen("--compress="));
+                return EXIT_FAILURE;
+            } else if (!compress_available(compression)) {
+                printf("Compression method \"%s\" is not available in this build.\n",
+                       argv[a] + strlen("--compress="));
+                return EXIT_FAILURE;
+            }
+        } else if (strncmpci(argv[a], "PATH:", 5) == 0) {
             alt_path = true;
             // define alternate graphics path variable
-            char *p = argv[2] + strlen("PATH:");
-            strcpy(alt_graphics_path, p);
+            char *p = argv[a] + strlen("PATH:");
+            strlcpy(alt_graphics_path, p, MAX_PATH);
             printf("Alternate graphics path selected:\n=> %s \n(run program without 'PATH:' flag to use default graphics path)\n\n", alt_graphics_path);
-        } else if ((argv[2] != NULL) && (strncmpci(argv[2], "-n", 2) == 0)) {
+        } else if (strcmp(argv[a], "-L") == 0) {
+            label_data = true;
+        } else if (strncmpci(argv[a], "-n", 2) == 0) {
             non_SAP_fields = true;
             printf("Including non-SAP column headings in IDoc. Run program without '-n' flag to remove.\n");
+        } else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
         }
+    }
 
-    if ((fp = fopen(argv[1], "r")) == NULL) {
-        printf("File not found.\n");
-        return EXIT_FAILURE;
-    } else {
-        read_spreadsheet(fp);
+    if (use_mmap && (pipeline || compression != COMPRESS_NONE)) {
+        printf("--mmap is ignored with --pipeline and --compress.\n");
+        use_mmap = false;
     }
-    fclose(fp);
 
-    labels = (Label_record *) calloc(spreadsheet_row_number, spreadsheet_row_number * sizeof(Label_record));
+    if (fp_stdout && (use_mmap || use_uring)) {
+        printf("--mmap and --uring are ignored with --stdout.\n");
+        use_mmap = use_uring = false;
+    }
 
-    // check spreadsheet columns for duplicates
-    if (duplicate_column_names(spreadsheet[0])) {
-        printf("Duplicate column names in spreadsheet. Aborting.\n");
+    if (use_uring && (use_mmap || compression != COMPRESS_NONE)) {
+        printf("--uring is ignored with --mmap and --compress.\n");
+        use_uring = false;
+    }
+    if (sync_output && !use_uring) {
+        printf("--fsync is ignored without --uring.\n");
+        sync_output = false;
+    }
+
+    if (group_material && pipeline) {
+        printf("--group-material is ignored with --pipeline.\n");
+        group_material = false;
+    }
+
+    if (duplicates != DUPLICATES_KEEP && pipeline) {
+        printf("--duplicates is ignored with --pipeline.\n");
+        duplicates = DUPLICATES_KEEP;
+    }
+
+    // the cached labels were resolved by the policy of the run that wrote them
+    if (duplicates != DUPLICATES_KEEP && use_cache) {
+        printf("--cache is ignored with --duplicates.\n");
+        use_cache = false;
+    }
+
+    if (watch_dir != NULL && fp_stdout) {
+        printf("--stdout can not be used with --watch.\n");
         return EXIT_FAILURE;
     }
 
-    // move data into label_record fields by column header
-    if (parse_spreadsheet(spreadsheet[0], labels) == -1) {
-        printf("Aborting.\n");
+    // the watching process forks a worker for every dropped spreadsheet; only the workers go on
+    if (watch_dir != NULL) {
+        const char *sheet;
+        int watching = watch_run(watch_dir, threads ? threads : (int) cpus, &sheet);
+
+        if (watching != 1)
+            return watching == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        argv[1] = (char *) sheet;
+        // the worker is timed from when it was forked, not from when the watch began
+        start = clock();
+    }
+
+    if (from_stdin && use_cache) {
+        printf("--cache is ignored when reading from standard input.\n");
+        use_cache = false;
+    }
+
+    // a spreadsheet parsed by an earlier run goes straight to printing
+    if (use_cache && !pipeline) {
+        if (cache_key(argv[1], &key) != 0)
+            use_cache = false;
+        else if ((labels = cache_load(argv[1], &key, header, &spreadsheet_row_number)) != NULL) {
+            printf("Using parsed labels from \"%s.cache\"\n", argv[1]);
+            cached = true;
+            // only the default policy is cached, and it prints every row it reports
+            duplicates_replay(labels, spreadsheet_row_number);
+        }
+    }
+
+    // gzip and zstd compressed spreadsheets are decoded on the fly
+    if (cached) {
+        fp_sheet = NULL;
+    } else if ((fp = from_stdin ? stdin : fopen(argv[1], "rb")) == NULL) {
+        printf("File not found.\n");
+        return EXIT_FAILURE;
+    } else if ((fp_sheet = compress_open_input(fp)) == NULL) {
+        printf("Could not decompress input file %s.\n", argv[1]);
         return EXIT_FAILURE;
     }
 
-    // the labels array must be sorted by label number
-    sort_labels(labels);
+    // a spreadsheet too large for the memory budget is streamed instead
+    if (!pipeline && !cached && read_spreadsheet(fp_sheet) != 0) {
+        printf("Spreadsheet does not fit in --max-memory; streaming it instead. It must be sorted by LABEL.\n");
+        pipeline = true;
+        use_mmap = false;
+        buffered = spreadsheet_row_number;
+        if (group_material) {
+            printf("--group-material is ignored for a streamed spreadsheet.\n");
+            group_material = false;
+        }
+        if (duplicates != DUPLICATES_KEEP)
+            printf("--duplicates is ignored for a streamed spreadsheet.\n");
+    }
 
-    // output files (the idoc file and the label_data file)
-    char *output_idocfile = (char *) malloc(strlen(argv[1]) + FILE_EXT_LEN);
-    sscanf(argv[1], "%[^.]%*[txt]", output_idocfile);
+    if (pipeline) {
+        // only the column headings are read up front; the rows are streamed
+        char *headings = buffered > 0 ? spreadsheet[0] : read_row(fp_sheet);
 
-    strcat(output_idocfile, "_IDoc (stoidoc).txt");
+        if (headings == NULL || duplicate_column_names(headings)) {
+            printf("Duplicate column names in spreadsheet. Aborting.\n");
+            return EXIT_FAILURE;
+        }
+        if (parse_header(headings, header) == -1) {
+            printf("Aborting.\n");
+            return EXIT_FAILURE;
+        }
+        if (buffered > 0)
+            memory_charge(MEM_ROWS, -(long long) (strlen(headings) + 1));
+        free(headings);
+        labels = NULL;
+    } else if (!cached) {
+        if (compress_close(fp_sheet) != 0) {
+            printf("Could not decompress input file %s.\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+
+        if ((labels = (Label_record *) calloc(spreadsheet_row_number, sizeof(Label_record))) == NULL) {
+            printf("Could not allocate %d label records. Aborting.\n", spreadsheet_row_number);
+            return EXIT_FAILURE;
+        }
+        memory_charge(MEM_RECORDS, (long long) spreadsheet_row_number * (long long) sizeof(Label_record));
 
-    printf("Creating IDoc file \"%s\"\n", output_idocfile);
+        // check spreadsheet columns for duplicates
+        if (duplicate_column_names(spreadsheet[0])) {
+            printf("Duplicate column names in spreadsheet. Aborting.\n");
+            return EXIT_FAILURE;
+        }
 
-    if ((fpout_idoc = fopen(output_idocfile, "w")) == NULL) {
-        printf("Could not open output file %s", output_idocfile);
+        // move data into label_record fields by column header
+        if (parse_spreadsheet(spreadsheet[0], header, labels, threads ? threads : (int) cpus) == -1) {
+            printf("Aborting.\n");
+            return EXIT_FAILURE;
+        }
+
+        // rows repeating a LABEL are found while the records are still in row order
+        if (duplicates_resolve(header, labels, duplicates) == -1)
+            return EXIT_FAILURE;
+
+        // the labels array must be sorted by label number
+        sort_labels(labels);
+
+        // the sorted records are cached, so that a run on the same spreadsheet skips parsing and sorting
+        if (use_cache && cache_store(argv[1], &key, header, labels, spreadsheet_row_number) != 0)
+            printf("Could not write cache file \"%s.cache\"\n", argv[1]);
+    }
+
+    // the cache keeps the LABEL order, so the records are grouped after it is written or read
+    if (group_material) {
+        int ungrouped = count_material_records(labels);
+
+        if (sort_labels_by_material(labels) != 0) {
+            printf("Could not group the records by MATERIAL. Aborting.\n");
+            return EXIT_FAILURE;
+        }
+        int grouped = count_material_records(labels);
+        printf("Grouped by MATERIAL: %d MATERIAL records instead of %d (%d saved)\n",
+               grouped, ungrouped, ungrouped - grouped);
+    }
+
+    // only the records of the columns the sheet has are printed
+    build_emit_plan(plan, header);
+
+    // the graphics directory is read once; each graphic is then looked up in memory
+    if (verify_graphics) {
+        const char *directory = alt_path ? alt_graphics_path : GRAPHICS_PATH;
+        int found = graphics_index(directory);
+
+        if (found == -1) {
+            printf("Could not read graphics directory \"%s\". Graphics are not verified.\n", directory);
+            verify_graphics = false;
+        } else
+            printf("Verifying graphics against %d files in \"%s\"\n", found, directory);
+    }
+
+    // output files (the idoc file and the label_data file), named after the spreadsheet
+    const char *sheet_name = from_stdin ? STDIN_NAME : argv[1];
+    char *output_idocfile = (char *) malloc(strlen(sheet_name) + FILE_EXT_LEN);
+    sscanf(sheet_name, "%[^.]%*[txt]", output_idocfile);
+
+    strcat(output_idocfile, "_IDoc (stoidoc).txt");
+    strcat(output_idocfile, compress_extension(compression));
+
+    if (fp_stdout)
+        printf("Writing IDoc file to standard output\n");
+    else
+        printf("Creating IDoc file \"%s\"\n", output_idocfile);
+
+    // the mapped output file is only created once its size is known
+    if (use_mmap)
+        fpout_idoc = NULL;
+    else if (fp_stdout)
+        fpout_idoc = compression != COMPRESS_NONE ? compress_wrap_output(fp_stdout, compression) : fp_stdout;
+    else if (compression != COMPRESS_NONE)
+        fpout_idoc = compress_open_output(output_idocfile, compression);
+    else if (use_uring) {
+        fpout_idoc = uring_open_output(output_idocfile, sync_output);
+        if (fpout_idoc != NULL && !uring_active())
+            printf("io_uring is not available, writing the IDoc file with write().\n");
+    } else
+        fpout_idoc = fopen(output_idocfile, "w");
+
+    if (fpout_idoc == NULL && !use_mmap) {
+        printf("Could not open output file %s\n", output_idocfile);
+        return EXIT_FAILURE;
     }
 
-    char *output_datafile = NULL;
     if (label_data) {
-        output_datafile = (char *) malloc(strlen(argv[1]) + FILE_EXT_LEN);
-        sscanf(argv[1], "%[^.]%*[txt]", output_datafile);
-        strcat(output_datafile, "_labeldata.txt");
-        if ((fpout_data = fopen(output_datafile, "w")) == NULL) {
-            printf("Could not open output file %s", output_datafile);
+        char *output_database = (char *) malloc(strlen(sheet_name) + FILE_EXT_LEN);
+        sscanf(sheet_name, "%[^.]%*[txt]", output_database);
+        printf("Creating label data files \"%s_labeldata.csv\" and \"%s_labeldata.bin\"\n",
+               output_database, output_database);
+        if ((fpout_data = labeldata_open(output_database)) == NULL) {
+            printf("Could not open output file %s_labeldata.csv\n", output_database);
+            return EXIT_FAILURE;
         }
+        free(output_database);
     }
 
-    if (print_control_record(fpout_idoc, &idoc) != 0)
+    if (!use_mmap && print_control_record(fpout_idoc, &idoc) != 0)
         return EXIT_FAILURE;
 
-    {
+    if (use_mmap) {
+        if (mapout_write(output_idocfile, plan, labels, spreadsheet_row_number, fpout_data,
+                         threads ? threads : (int) cpus, &idoc) != 0)
+            return EXIT_FAILURE;
+    } else if (pipeline) {
+        // the reader and the writer have a thread each
+        int workers = threads ? threads : (cpus > 2 ? (int) cpus - 2 : 1);
+        int status = pipeline_run(fp_sheet, spreadsheet + 1, buffered > 0 ? buffered - 1 : 0,
+                                  header, plan, fpout_idoc, fpout_data, workers, &idoc);
+
+        // the pipeline has freed the buffered rows
+        spreadsheet_row_number = 0;
+
+        if (compress_close(fp_sheet) != 0) {
+            printf("Could not decompress input file %s.\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+        if (status != 0)
+            return EXIT_FAILURE;
+    } else {
         int i = 1;
         while (i < spreadsheet_row_number) {
-            // if label_data, include fpout_data
-            if ((print_label_idoc_records(fpout_idoc, labels, i, &idoc)))
+            if (fpout_data && labeldata_add(fpout_data, &labels[i]) != 0) {
+                printf("Could not write label data, line %d. Aborting.\n", i);
+                return EXIT_FAILURE;
+            }
+            if ((print_label_idoc_records(fpout_idoc, plan, &labels[i], i, &idoc)))
                 i++;
             else {
                 printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", i);
@@ -1272,23 +1537,41 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    fclose(fpout_idoc);
+    if (!use_mmap && compress_close(fpout_idoc) != 0) {
+        printf("Could not write output file %s\n", output_idocfile);
+        return EXIT_FAILURE;
+    }
 
-    if (output_datafile) {
-        fclose(fpout_data);
-        free(output_datafile);
+    if (fpout_data && labeldata_close(fpout_data) != 0) {
+        printf("Could not write label data files\n");
+        return EXIT_FAILURE;
     }
     free(output_idocfile);
+    tails_release();
+    suggest_release();
 
+    if (verify_graphics) {
+        if (graphics_missing() > 0)
+            printf("%d graphics are not in the graphics directory.\n", graphics_missing());
+        graphics_release();
+    }
+
+    if (cached) {
+        cache_release();
+        spreadsheet_row_number = 0;
+    }
 
     for (int i = 0; i < spreadsheet_row_number; i++)
         free(spreadsheet[i]);
     free(spreadsheet);
 
-    for (int i = 1; i < spreadsheet_row_number; i++)
-        free(labels[i].tdline);
+    if (max_memory > 0)
+        memory_report();
 
-    free(labels);
+    if (!cached)
+        free(labels);
+    free(header);
+    free(plan);
 
     clock_t stop = clock();
     double elapsed = (double) (stop - start) / CLOCKS_PER_SEC;
@@ -0,0 +1,98 @@
+/**
+    @file idoc.h
+    Together with idoc.c, this component is responsible for printing the
+    IDoc control record and the IDoc records of each label record.
+*/
+
+#ifndef STOIDOC_IDOC_H
+#define STOIDOC_IDOC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "label.h"
+
+/** a global struct variable of IDoc sequence numbers                    */
+struct control_numbers {
+    char ctrl_num[8];
+    int matl_seq_number;
+    int labl_seq_number;
+    int tdline_seq_number;
+    int char_seq_number;
+    int record;                 // the record being printed
+    int sequence_number;        // the sequence number of the next segment
+    char prev_material[LRG];    // the material of the last MATERIAL record
+    bool replay;                // records printed again: nothing is reported, no cache is updated
+};
+
+/** defining the struct variable as a new type for convenience           */
+typedef struct control_numbers Ctrl;
+
+/**
+    prints the IDoc control record
+    @param fpout points to the output file
+*/
+int print_control_record(FILE *fpout, Ctrl *idoc);
+
+/* when a step of an emission plan is included                           */
+#define EMIT_ALWAYS             1   // whatever the columns of the sheet
+#define EMIT_FIELD              2   // if a column fills its text field
+#define EMIT_SYMBOL             4   // if a column fills its symbol
+#define EMIT_NON_SAP            8   // only with the -n flag
+
+/** the record being printed, shared by the steps of an emission plan   */
+typedef struct {
+    FILE *fpout;
+    Label_record *label;
+    int record;
+    Ctrl *idoc;
+} Emit_context;
+
+typedef struct Emit_step Emit_step;
+
+/** prints the IDoc record(s) of one column; returns 0 to abort           */
+typedef int (*Emitter)(Emit_context *ctx, const Emit_step *step);
+
+/** a step of an emission plan: an emitter and its constant arguments    */
+struct Emit_step {
+    Emitter emit;
+    int presence;
+    const char *name;
+    size_t offset;
+    uint32_t symbols;           // a bit per symbol printed
+    int slot;
+    uint64_t lanes;             // the symbols as a mask of symbol_values lanes
+    const char *graphic;
+};
+
+/* the number of steps in the complete emission plan, and then some      */
+#define MAX_EMIT_STEPS        128
+
+/** the steps printing the records of the columns a sheet actually has  */
+typedef struct {
+    int count;
+    Emit_step steps[MAX_EMIT_STEPS];
+} Emit_plan;
+
+/**
+    builds the emission plan of a sheet: the steps of the columns it has,
+    in IDoc order, plus the steps printed whatever the columns
+    @param plan receives the steps
+    @param header contains the resolved column headings, or NULL for all steps
+    @return the number of steps
+*/
+int build_emit_plan(Emit_plan *plan, const Sheet_header *header);
+
+/**
+    prints the remaining IDoc records of a label record by running the
+    steps of the emission plan
+    @param fpout points to the output file
+    @param plan is the emission plan of the sheet
+    @param label is the label record being processed
+    @param record is the record number being processed
+    @param idoc is a Ctrl structure containing sequence numbers
+    @return true if a label_idoc_record was printed successfully
+*/
+int print_label_idoc_records(FILE *fpout, const Emit_plan *plan, Label_record *label, int record, Ctrl *idoc);
+
+#endif //STOIDOC_IDOC_H
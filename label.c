@@ -3,12 +3,16 @@
  */
 #include "label.h"
 #include "strl.h"
+#include "memory.h"
+#include "text.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 
 /**
     This function initializes the dynamically allocated spreadsheet array.
@@ -26,11 +30,13 @@ int spreadsheet_init() {
 
 int spreadsheet_expand() {
 
-    spreadsheet_cap *= 2;
-    if ((spreadsheet = (char **) realloc(spreadsheet, spreadsheet_cap * sizeof(char *))) == NULL)
+    // the rows are kept, and the capacity unchanged, if the array can not grow
+    char **grown = (char **) realloc(spreadsheet, 2 * spreadsheet_cap * sizeof(char *));
+    if (grown == NULL)
         return -1;
-    else
-        return 0;
+    spreadsheet = grown;
+    spreadsheet_cap *= 2;
+    return 0;
 }
 
 char *get_token(char *buffer, char tab_str) {
@@ -133,55 +139,75 @@ int strncmpci(const char *str1, const char *str2, int num) {
     return ret_code;
 }
 
+/* the upper case cell values with a class of their own, packed in 8 bytes */
+static const struct {
+    char value[8];
+    int cell_class;
+} cell_values[] = {
+        {"Y",       CELL_Y},
+        {"YES",     CELL_Y},
+        {"N",       CELL_N},
+        {"NO",      CELL_N},
+        {"F_Y",     CELL_F_Y},
+        {"F_YES",   CELL_F_Y},
+        {"ISO_Y",   CELL_ISO_Y},
+        {"ISO_YES", CELL_ISO_Y},
+        {"N/A",     CELL_NA}
+};
+
+int classify_cell(const char *cell, size_t length) {
+    const uint64_t high_bits = 0x8080808080808080ULL;
+    uint64_t word = 0;
+    int cell_class = CELL_TEXT;
+
+    if (length == 0)
+        return CELL_EMPTY;
+    // the longest value with a class of its own is "ISO_YES"
+    if (length > 7)
+        return CELL_TEXT;
+
+    memcpy(&word, cell, length);
+    if (word & high_bits)
+        return CELL_TEXT;
+
+    // upper-case all 8 bytes at once: a byte is lower case if adding 0x1f
+    // sets its high bit (>= 'a') and adding 0x05 does not (<= 'z')
+    uint64_t lower = (word + 0x1f1f1f1f1f1f1f1fULL) & ~(word + 0x0505050505050505ULL) & high_bits;
+    word ^= lower >> 2;
+
+    for (size_t i = 0; i < sizeof(cell_values) / sizeof(cell_values[0]); i++) {
+        uint64_t value;
+        memcpy(&value, cell_values[i].value, sizeof(value));
+        cell_class = word == value ? cell_values[i].cell_class : cell_class;
+    }
+    return cell_class;
+}
+
 int equals_yes(char *field) {
-    return ((strcasecmp(field, "Y") == 0) || (strcasecmp(field, "Yes") == 0));
+    return classify_cell(field, strlen(field)) == CELL_Y;
 }
 
 int graphic_type(char *field) {
-    if ((strcasecmp(field, "Y") == 0) || (strcasecmp(field, "Yes") == 0))
-        return 2;
-    else if ((strcasecmp(field, "N") == 0) || (strcasecmp(field, "NO") == 0))
-        return 1;
-    else if ((strcasecmp(field, "F_Y") == 0) || (strcasecmp(field, "F_Yes") == 0))
-        return 3;
-    else if ((strcasecmp(field, "ISO_Y") == 0) || (strcasecmp(field, "ISO_Yes") == 0))
-        return 4;
+    int cell_class = classify_cell(field, strlen(field));
 
+    // anything else (including an empty cell) is printed like a "N"
+    return cell_class >= CELL_N && cell_class <= CELL_ISO_Y ? cell_class : CELL_N;
 }
 int equals_no(char *field) {
-    return ((strcasecmp(field, "N") == 0) || (strcasecmp(field, "NO") == 0));
+    return classify_cell(field, strlen(field)) == CELL_N;
 }
 
-int get_field_contents_from_row(char *contents, int i, int count, char tab_str) {
-
-    int start = 0;
-    int stop = 0;
-
-    if (count == 0)
-        start = 0;
-    else if ((start = peek_nth_token(count, spreadsheet[i], tab_str)) == -1)
-        start = (int) strlen(spreadsheet[i]);
-    else
-        start++;
-
-    if ((stop = peek_nth_token(count + 1, spreadsheet[i], tab_str)) == -1)
-        stop = (int) strlen(spreadsheet[i]);
-
-    int length = stop - start;
-    strncpy(contents, spreadsheet[i] + start, (size_t) length);
-    contents[length] = '\0';
+int get_cell_contents(char *contents, size_t size, const char *cell, int length) {
 
     // check if there's an .tif extension and remove it if so
-    if ((length > 4) && ((contents[length - 4]) == '.')) {
-        char *suffix = contents + length - 3;
-        if (strcmp(suffix, "tif") == 0)
-            contents[length - 4] = '\0';
-    }
+    if ((length > 4) && (cell[length - 4] == '.') && (strncmp(cell + length - 3, "tif", 3) == 0))
+        length -= 4;
 
-    if (equals_no(contents))
-        return 0;
-    else
-        return length;
+    size_t copied = (size_t) length < size ? (size_t) length : text_utf8_cut(cell, (size_t) length, size - 1);
+    memcpy(contents, cell, copied);
+    contents[copied] = '\0';
+
+    return classify_cell(contents, copied);
 }
 
 int duplicate_column_names(const char *cols) {
@@ -245,30 +271,166 @@ int duplicate_column_names(const char *cols) {
 }
 
 
-int parse_spreadsheet(char *buffer, Label_record *labels) {
-    unsigned short count = 0;
+/* the offset and size of a Label_record field                           */
+#define FIELD(f)    offsetof(Label_record, f), sizeof(((Label_record *) 0)->f)
+
+/** Recognized spreadsheet column headings and the fields they fill      */
+const Column_def column_defs[] = {
+        {"LABEL",              FIELD_TEXT,     FIELD(label),              0,                    false},
+        {"MATERIAL",           FIELD_TEXT,     FIELD(material),           0,                    false},
+        {"PCODE",              FIELD_TEXT,     FIELD(material),           0,                    false},
+        {"TDLINE",             FIELD_TDLINE,   FIELD(tdline),             0,                    false},
+        {"ADDRESS",            FIELD_TEXT,     FIELD(address),            0,                    false},
+        {"BARCODETEXT",        FIELD_TEXT,     FIELD(barcodetext),        0,                    false},
+        {"BARCODE1",           FIELD_TEXT,     FIELD(barcode1),           0,                    false},
+        {"GS1",                FIELD_TEXT,     FIELD(gs1),                0,                    false},
+        {"GTIN",               FIELD_TEXT,     FIELD(gtin),               0,                    true},
+        {"BOMLEVEL",           FIELD_TEXT,     FIELD(bomlevel),           0,                    false},
+        {"CAUTION",            FIELD_SYMBOL,   0, 0,                      SYM_CAUTION,          false},
+        {"CAUTIONSTATE",       FIELD_TEXT,     FIELD(cautionstatement),   0,                    false},
+        {"CE0120",             FIELD_TEXT,     FIELD(cemark),             0,                    false},
+        {"CEMARK",             FIELD_TEXT,     FIELD(cemark),             0,                    false},
+        {"CE",                 FIELD_TEXT,     FIELD(cemark),             0,                    false},
+        {"CONSULTIFU",         FIELD_SYMBOL,   0, 0,                      SYM_CONSULTIFU,       false},
+        {"CONTAINSLATEX",      FIELD_SYMBOL,   0, 0,                      SYM_LATEX,            false},
+        {"COOSTATE",           FIELD_TEXT,     FIELD(coostate),           0,                    false},
+        {"DESCRIPTION",        FIELD_TEXT,     FIELD(description),        0,                    true},
+        {"DISTRIBUTEDBY",      FIELD_TEXT,     FIELD(distby),             0,                    false},
+        {"DONOTUSEDAM",        FIELD_SYMBOL,   0, 0,                      SYM_DONOTUSEDAMAGED,  false},
+        {"DONOTPAKDAM",        FIELD_SYMBOL,   0, 0,                      SYM_DONOTUSEDAMAGED,  false},
+        {"ECREP",              FIELD_SYMBOL,   0, 0,                      SYM_ECREP,            false},
+        {"ECREPADDRESS",       FIELD_TEXT,     FIELD(ecrepaddress),       0,                    false},
+        {"ELECTROSURIFU",      FIELD_SYMBOL,   0, 0,                      SYM_ELECTROIFU,       false},
+        {"EXPDATE",            FIELD_SYMBOL,   0, 0,                      SYM_EXPDATE,          false},
+        {"FLGRAPHIC",          FIELD_TEXT,     FIELD(flgraphic),          0,                    false},
+        {"KEEPAWAYHEAT",       FIELD_SYMBOL,   0, 0,                      SYM_KEEPAWAYHEAT,     false},
+        {"INSERTGRAPHIC",      FIELD_TEXT,     FIELD(insertgraphic),      0,                    false},
+        {"KEEPDRY",            FIELD_YES,      0, 0,                      SYM_KEEPDRY,          false},
+        {"LABELGRAPH1",        FIELD_TEXT,     FIELD(labelgraph1),        0,                    false},
+        {"LABELGRAPH2",        FIELD_TEXT,     FIELD(labelgraph2),        0,                    false},
+        {"LATEXFREE",          FIELD_SYMBOL,   0, 0,                      SYM_LATEXFREE,        false},
+        {"LATEXSTATEMENT",     FIELD_TEXT,     FIELD(latexstatement),     0,                    false},
+        {"LEVEL",              FIELD_TEXT,     FIELD(level),              0,                    false},
+        {"LOGO1",              FIELD_TEXT,     FIELD(logo1),              0,                    false},
+        {"LOGO2",              FIELD_TEXT,     FIELD(logo2),              0,                    false},
+        {"LOGO3",              FIELD_TEXT,     FIELD(logo3),              0,                    false},
+        {"LOGO4",              FIELD_TEXT,     FIELD(logo4),              0,                    false},
+        {"LOGO5",              FIELD_TEXT,     FIELD(logo5),              0,                    false},
+        {"MDR1",               FIELD_TEXT,     FIELD(mdr1),               0,                    false},
+        {"MDR2",               FIELD_TEXT,     FIELD(mdr2),               0,                    false},
+        {"MDR3",               FIELD_TEXT,     FIELD(mdr3),               0,                    false},
+        {"MDR4",               FIELD_TEXT,     FIELD(mdr4),               0,                    false},
+        {"MDR5",               FIELD_TEXT_SET, FIELD(mdr5),               0,                    false},
+        {"LOTGRAPHIC",         FIELD_SYMBOL,   0, 0,                      SYM_LOTGRAPHIC,       false},
+        {"LTNUMBER",           FIELD_TEXT,     FIELD(ltnumber),           0,                    false},
+        {"IPN",                FIELD_TEXT,     FIELD(ipn),                0,                    false},
+        {"MANINBOX",           FIELD_SYMBOL,   0, 0,                      SYM_MANINBOX,         false},
+        {"MANUFACTUREDBY",     FIELD_TEXT,     FIELD(manufacturedby),     0,                    false},
+        {"MANUFACTURER",       FIELD_SYMBOL,   0, 0,                      SYM_MANUFACTURER,     false},
+        {"MFGDATE",            FIELD_SYMBOL,   0, 0,                      SYM_MFGDATE,          false},
+        {"NORESTERILE",        FIELD_SYMBOL,   0, 0,                      SYM_NORESTERILIZE,    false},
+        {"NONSTERILE",         FIELD_SYMBOL,   0, 0,                      SYM_NONSTERILE,       false},
+        {"OLDLABEL",           FIELD_TEXT,     FIELD(oldlabel),           0,                    true},
+        {"OLDTEMPLATE",        FIELD_TEXT,     FIELD(oldtemplate),        0,                    true},
+        {"PREVLABEL",          FIELD_TEXT,     FIELD(prevlabel),          0,                    true},
+        {"PREVTEMPLATE",       FIELD_TEXT,     FIELD(prevtemplate),       0,                    true},
+        {"PATENTSTA",          FIELD_TEXT,     FIELD(patentstatement),    0,                    false},
+        {"PHTDEHP",            FIELD_SYMBOL,   0, 0,                      SYM_PHTDEHP,          false},
+        {"PHTBBP",             FIELD_SYMBOL,   0, 0,                      SYM_PHTBBP,           false},
+        {"PHTDINP",            FIELD_SYMBOL,   0, 0,                      SYM_PHTDINP,          false},
+        {"PVCFREE",            FIELD_SYMBOL,   0, 0,                      SYM_PVCFREE,          false},
+        {"QUANTITY",           FIELD_TEXT,     FIELD(quantity),           0,                    false},
+        {"REF",                FIELD_SYMBOL,   0, 0,                      SYM_REF,              false},
+        {"REFNUMBER",          FIELD_SYMBOL,   0, 0,                      SYM_REFNUMBER,        false},
+        {"REUSABLE",           FIELD_SYMBOL,   0, 0,                      SYM_REUSABLE,         false},
+        {"REVISION",           FIELD_TEXT,     FIELD(revision),           0,                    false},
+        {"LABEL_RELEASE_DATE", FIELD_TEXT,     FIELD(release),            0,                    false},
+        {"RXONLY",             FIELD_SYMBOL,   0, 0,                      SYM_RXONLY,           false},
+        {"SINGLEUSE",          FIELD_SYMBOL,   0, 0,                      SYM_SINGLEUSEONLY,    false},
+        {"SERIAL",             FIELD_SYMBOL,   0, 0,                      SYM_SERIAL,           false},
+        {"SINGLEPATIENTUSE",   FIELD_SYMBOL,   0, 0,                      SYM_SINGLEPATIENTUSE, false},
+        {"SIZE",               FIELD_TEXT,     FIELD(size),               0,                    false},
+        {"SIZELOGO",           FIELD_SYMBOL,   0, 0,                      SYM_SIZELOGO,         false},
+        {"STERILITYTYPE",      FIELD_TEXT,     FIELD(sterilitytype),      0,                    false},
+        {"STERILESTA",         FIELD_TEXT,     FIELD(sterilitystatement), 0,                    false},
+        {"TEMPRANGE",          FIELD_TEXT,     FIELD(temprange),          0,                    false},
+        {"TEMPLATENUMBER",     FIELD_TEXT,     FIELD(template),           0,                    false},
+        {"TEMPLATE",           FIELD_TEXT,     FIELD(template),           0,                    false},
+        {"TFXLOGO",            FIELD_SYMBOL,   0, 0,                      SYM_TFXLOGO,          false},
+        {"VERSION",            FIELD_TEXT,     FIELD(version),            0,                    false}
+};
+
+/** number of recognized column headings                                 */
+const int column_defs_size = sizeof(column_defs) / sizeof(column_defs[0]);
+
+_Static_assert(sizeof(column_defs) / sizeof(column_defs[0]) <= MAX_CELL_SLOTS, "MAX_CELL_SLOTS is too small");
+
+int field_slot(size_t offset) {
+    for (int i = 0; i < column_defs_size; i++)
+        if (column_defs[i].kind != FIELD_SYMBOL && column_defs[i].kind != FIELD_YES &&
+            column_defs[i].offset == offset)
+            return i;
+    return -1;
+}
+
+int column_slot(const Column_def *def) {
+    if (def == NULL || def->kind == FIELD_SYMBOL || def->kind == FIELD_YES)
+        return -1;
+    return field_slot(def->offset);
+}
+
+void set_symbol(Label_record *label, int symbol, unsigned int value) {
+    uint64_t lane = (uint64_t) 3 << (2 * symbol);
+
+    if (value == 0) {
+        label->symbols_set &= ~(1u << symbol);
+        label->symbol_values &= ~lane;
+    } else {
+        label->symbols_set |= 1u << symbol;
+        label->symbol_values = (label->symbol_values & ~lane) | ((uint64_t) (value - 1) << (2 * symbol));
+    }
+}
+
+unsigned int get_symbol(const Label_record *label, int symbol) {
+    if (!(label->symbols_set & (1u << symbol)))
+        return 0;
+    return (unsigned int) ((label->symbol_values >> (2 * symbol)) & 3) + 1;
+}
+
+int parse_header(const char *buffer, Sheet_header *header) {
     bool material = 0;
     bool pcode = 0;
 
     char tab_str = TAB;
-    char contents[MAX_COLUMNS];
+    char *columns = (char *) malloc(strlen(buffer) + 1);
 
-    while (strlen(buffer) > 0) {
+    strcpy(columns, buffer);
+    header->count = 0;
+    header->last = 0;
+
+    while (strlen(columns) > 0 && header->count < MAX_COLUMNS) {
 
         // Keep extracting tokens while the delimiter is present in buffer
-        char *token = get_token(buffer, tab_str);
+        char *token = get_token(columns, tab_str);
+        const Column_def *def = NULL;
 
-        if (strcmp(token, "LABEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].label, contents, sizeof(labels[i].label));
+        for (int i = 0; i < column_defs_size; i++)
+            if (strcmp(token, column_defs[i].name) == 0) {
+                def = &column_defs[i];
+                break;
             }
+
+        if (def == NULL) {
+            if (strlen(token) > 0) {
+                if (strcmp(token, "CAUTIONSTATEMENT") == 0)
+                    printf("Change \"%s\" to \"CAUTIONSTATE.\" ", token);
+                printf("Ignoring column \"%s\"\n", token);
+            }
+        } else if (def->non_SAP && !non_SAP_fields) {
+            // the column is still read, so that the cached records serve runs with and without -n
+            printf("Ignoring column \"%s\"\n", token);
         } else if ((strcmp(token, "MATERIAL") == 0) ||
                    (strcmp(token, "PCODE") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].material, contents, sizeof(labels[i].material));
-            }
             if (strcmp(token, "MATERIAL") == 0)
                 material = true;
             else {
@@ -277,485 +439,250 @@ int parse_spreadsheet(char *buffer, Label_record *labels) {
             }
             if (pcode && material) {
                 printf("Found both \"MATERIAL\" and \"PCODE\" column headings. Eliminate one of these.\n");
+                free(token);
+                free(columns);
                 return -1;
             }
+        }
 
-        } else if (strcmp(token, "TDLINE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].tdline = (char *) malloc(strlen(contents) + 1);
-                strlcpy(labels[i].tdline, contents, sizeof(contents));
-            }
-        } else if (strcmp(token, "ADDRESS") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].address, contents, sizeof(labels[i].address));
-            }
-
-        } else if (strcmp(token, "BARCODETEXT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].barcodetext, contents, sizeof(labels[i].barcodetext));
-            }
-
-        } else if (strcmp(token, "BARCODE1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].barcode1, contents, sizeof(labels[i].barcode1));
-            }
-
-        } else if (strcmp(token, "GS1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].gs1, contents, sizeof(labels[i].gs1));
-            }
-
-        } else if (strcmp(token, "GTIN") == 0) {
-            if (non_SAP_fields) {
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].gtin, contents, sizeof(labels[i].gtin));
-                }
-            } else
-                printf("Ignoring column \"%s\"\n", token);
-
-
-        } else if (strcmp(token, "BOMLEVEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].bomlevel, contents, sizeof(labels[i].bomlevel));
-            }
-
-        } else if (strcmp(token, "CAUTION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].caution = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "CAUTIONSTATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].cautionstatement, contents, sizeof(labels[i].cautionstatement));
-            }
+        header->columns[header->count] = def;
+        header->slots[header->count++] = column_slot(def);
+        if (def != NULL)
+            header->last = header->count;
+        free(token);
+    }
 
-        } else if ((strcmp(token, "CE0120") == 0)  ||
-                  (strcmp(token, "CEMARK") == 0)  ||
-                  (strcmp(token, "CE") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].cemark, contents, sizeof(labels[i].cemark));
-            }
+    free(columns);
+    return header->count;
+}
 
-        } else if (strcmp(token, "CONSULTIFU") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].consultifu = graphic_type(contents);
-            }
+int parse_row(const Sheet_header *header, char *row, Label_record *label) {
+    char contents[MED];
+    char *cell = row;
+    int count;
 
-        } else if (strcmp(token, "CONTAINSLATEX") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].latex = graphic_type(contents);
-            }
+    for (count = 0; count < header->last; count++) {
+        const Column_def *def = header->columns[count];
 
-        } else if (strcmp(token, "COOSTATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].coostate, contents, sizeof(labels[i].coostate));
-            }
+        // ignored cells are stepped over without measuring them
+        if (def == NULL) {
+            char *end = strchr(cell, TAB);
+            cell = end ? end + 1 : cell + strlen(cell);
+            continue;
+        }
 
-        } else if (strcmp(token, "DESCRIPTION") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].description, contents, sizeof(labels[i].description));
+        // cells past the end of a short row are empty
+        char *end = strchr(cell, TAB);
+        int length = end ? (int) (end - cell) : (int) strlen(cell);
+        // taken before TDLINE is ended inside the row
+        char *next = end ? end + 1 : cell + length;
+
+        char *field = (char *) label + def->offset;
+        unsigned char *cell_class = &label->cells[header->slots[count]];
+        int value;
+
+        switch (def->kind) {
+            case FIELD_TEXT:
+                *cell_class = (unsigned char) get_cell_contents(field, def->size, cell, length);
+                break;
+            case FIELD_TEXT_SET:
+                value = get_cell_contents(contents, sizeof(contents), cell, length);
+                if (value != CELL_EMPTY && value != CELL_N) {
+                    strlcpy(field, contents, def->size);
+                    *cell_class = (unsigned char) classify_cell(field, strlen(field));
                 }
-            else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "DISTRIBUTEDBY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].distby, contents, sizeof(labels[i].distby));
-            }
-
-        } else if ((strcmp(token, "DONOTUSEDAM") == 0) ||
-                (strcmp(token, "DONOTPAKDAM") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].donotusedamaged = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "ECREP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].ecrep = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "ECREPADDRESS") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].ecrepaddress, contents, sizeof(labels[i].ecrepaddress));
-            }
-
-        } else if (strcmp(token, "ELECTROSURIFU") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].electroifu = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "EXPDATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].expdate = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "FLGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].flgraphic, contents, sizeof(labels[i].flgraphic));
-            }
-
-        } else if (strcmp(token, "KEEPAWAYHEAT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].keepawayheat = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "INSERTGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].insertgraphic, contents, sizeof(labels[i].insertgraphic));
-            }
-
-        } else if (strcmp(token, "KEEPDRY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                if (equals_yes(contents))
-                    labels[i].keepdry = 2;
-            }
-
-        } else if (strcmp(token, "LABELGRAPH1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].labelgraph1, contents, sizeof(labels[i].labelgraph1));
-            }
-
-        } else if (strcmp(token, "LABELGRAPH2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].labelgraph2, contents, sizeof(labels[i].labelgraph2));
-            }
-
-        } else if (strcmp(token, "LATEXFREE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].latexfree = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "LATEXSTATEMENT") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].latexstatement, contents, sizeof(labels[i].latexstatement));
-            }
-
-        } else if (strcmp(token, "LEVEL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].level, contents, sizeof(labels[i].level));
-            }
-
-        } else if (strcmp(token, "LOGO1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo1, contents, sizeof(labels[i].logo1));
-            }
-
-        } else if (strcmp(token, "LOGO2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo2, contents, sizeof(labels[i].logo2));
-            }
+                break;
+            case FIELD_TDLINE:
+                // the text stays in the row, without any .tif extension
+                if ((length > 4) && (cell[length - 4] == '.') && (strncmp(cell + length - 3, "tif", 3) == 0))
+                    length -= 4;
+                label->tdline = cell;
+                *cell_class = (unsigned char) classify_cell(cell, (size_t) length);
+                cell[length] = '\0';
+                break;
+            case FIELD_SYMBOL:
+                value = get_cell_contents(contents, sizeof(contents), cell, length);
+                // anything else (including an empty cell) is printed like a "N"
+                set_symbol(label, def->symbol, value >= CELL_N && value <= CELL_ISO_Y ? value : CELL_N);
+                break;
+            case FIELD_YES:
+                if (get_cell_contents(contents, sizeof(contents), cell, length) == CELL_Y)
+                    set_symbol(label, def->symbol, CELL_Y);
+                break;
+            default:
+                break;
+        }
+        cell = next;
+    }
 
-        } else if (strcmp(token, "LOGO3") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo3, contents, sizeof(labels[i].logo3));
-            }
+    // the ignored cells after the last column that is read
+    for (; count < header->count && *cell; count++) {
+        char *end = strchr(cell, TAB);
+        cell = end ? end + 1 : cell + strlen(cell);
+    }
 
-        } else if (strcmp(token, "LOGO4") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo4, contents, sizeof(labels[i].logo4));
-            }
+    decode_fields(label);
+
+    // count the cells past the last column heading that are not blank
+    int extra = 0;
+    bool blank = true;
+    for (; *cell; cell++) {
+        if (*cell == TAB) {
+            extra += !blank;
+            blank = true;
+        } else if (*cell != ' ' && *cell != '\r')
+            blank = false;
+    }
+    label->row_bytes = (size_t) (cell - row) + 1;
+    return extra + !blank;
+}
 
-        } else if (strcmp(token, "LOGO5") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].logo5, contents, sizeof(labels[i].logo5));
-            }
+/**
+    reads a decimal integer the way "%d" does: after any white space, an
+    optional sign and at least one digit
+    @param text is the text to read
+    @param value receives the integer
+    @return true if there was an integer to read
+*/
+static bool read_int(const char *text, int *value) {
+    bool negative = false;
+    int number = 0;
+
+    while (*text == ' ' || (*text >= '\t' && *text <= '\r'))
+        text++;
+    if (*text == '-' || *text == '+')
+        negative = *text++ == '-';
+    if (*text < '0' || *text > '9')
+        return false;
+    // the fields read are too short to overflow
+    while (*text >= '0' && *text <= '9')
+        number = number * 10 + (*text++ - '0');
+    *value = negative ? -number : number;
+    return true;
+}
 
-        } else if (strcmp(token, "MDR1") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr1, contents, sizeof(labels[i].mdr1));
-            }
+/**
+    decodes a GTIN field: its number of digits, and their value
+    @param text is the field
+    @param gtin receives the decoded field
+*/
+static void decode_gtin(const char *text, Gtin_value *gtin) {
+    int digits = 0;
+    long long number = 0;
 
-        } else if (strcmp(token, "MDR2") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr2, contents, sizeof(labels[i].mdr2));
-            }
+    for (; text[digits] >= '0' && text[digits] <= '9'; digits++)
+        if (digits < 18)
+            number = number * 10 + (text[digits] - '0');
 
-        } else if (strcmp(token, "MDR3") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr3, contents, sizeof(labels[i].mdr3));
-            }
+    gtin->digits = text[digits] == '\0' ? digits : 0;
+    gtin->number = gtin->digits > 0 && gtin->digits <= 18 ? number : 0;
+}
 
-        } else if (strcmp(token, "MDR4") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].mdr4, contents, sizeof(labels[i].mdr4));
-            }
+void decode_fields(Label_record *label) {
+    int value;
 
-        } else if (strcmp(token, "MDR5") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                if (get_field_contents_from_row(contents, i, count, tab_str)) {
-                    strlcpy(labels[i].mdr5, contents, sizeof(labels[i].mdr5));
-                }
-            }
+    if (label->revision[0] == 'R' && read_int(label->revision + 1, &value) && value >= 0 && value <= 99)
+        label->revision_number = value;
+    else
+        label->revision_number = -1;
 
-        } else if (strcmp(token, "LOTGRAPHIC") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].lotgraphic = graphic_type(contents);
-            }
-        } else if (strcmp(token, "LTNUMBER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strncpy(labels[i].ltnumber, contents, sizeof(labels[0].ltnumber));
-            }
+    label->release_date = read_int(label->release, &value) ? value : 0;
 
-        } else if (strcmp(token, "IPN") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strncpy(labels[i].ipn, contents, sizeof(labels[0].ipn));
-            }
+    decode_gtin(label->barcodetext, &label->gtins[GTIN_BARCODETEXT]);
+    decode_gtin(label->gtin, &label->gtins[GTIN_GTIN]);
+    decode_gtin(label->barcode1, &label->gtins[GTIN_BARCODE1]);
+    decode_gtin(label->gs1, &label->gtins[GTIN_GS1]);
+}
 
-        } else if (strcmp(token, "MANINBOX") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].maninbox = graphic_type(contents);
-            }
-        } else if (strcmp(token, "MANUFACTUREDBY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].manufacturedby, contents, sizeof(labels[i].manufacturedby));
-            }
+/** a range of rows parsed by one thread, and the rows it found fault with */
+typedef struct {
+    const Sheet_header *header;
+    Label_record *labels;
+    int first;
+    int last;
+    int *errors;
+    int error_count;
+} Parse_shard;
 
-        } else if (strcmp(token, "MANUFACTURER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].manufacturer = graphic_type(contents);
-            }
-        } else if (strcmp(token, "MFGDATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].mfgdate = graphic_type(contents);
-            }
-        } else if (strcmp(token, "NORESTERILE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].noresterilize = graphic_type(contents);
-            }
-        } else if (strcmp(token, "NONSTERILE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].nonsterile = graphic_type(contents);
-            }
-        } else if (strcmp(token, "OLDLABEL") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].oldlabel, contents, sizeof(labels[i].oldlabel));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
+/**
+    parses the rows of a shard into their label records, noting every row
+    with more cells than column headings
+    @param arg is the Parse_shard
+    @return NULL
+*/
+static void *parse_shard(void *arg) {
+    Parse_shard *shard = (Parse_shard *) arg;
+    long long tdline_bytes = 0;
+
+    for (int i = shard->first; i < shard->last; i++) {
+        int extra = parse_row(shard->header, spreadsheet[i], &shard->labels[i]);
+        if (extra > 0 && shard->errors != NULL) {
+            shard->errors[shard->error_count++] = i;
+            shard->errors[shard->error_count++] = extra;
+        }
+        if (shard->labels[i].tdline != NULL)
+            tdline_bytes += (long long) strlen(shard->labels[i].tdline);
+    }
+    // the TDLINE text stays in its row, but is accounted on its own
+    memory_move(MEM_ROWS, MEM_TDLINE, tdline_bytes);
+    return NULL;
+}
 
-        } else if (strcmp(token, "OLDTEMPLATE") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].oldtemplate, contents, sizeof(labels[i].oldtemplate));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
+int parse_spreadsheet(char *buffer, Sheet_header *header, Label_record *labels, int threads) {
+    int count = parse_header(buffer, header);
+    int rows = spreadsheet_row_number - 1;
+
+    if (count != -1 && rows > 0) {
+        // small sheets are not worth a thread per shard
+        if (threads > rows / PARSE_SHARD_MIN)
+            threads = rows / PARSE_SHARD_MIN;
+        if (threads < 1)
+            threads = 1;
+
+        Parse_shard *shards = (Parse_shard *) calloc(threads, sizeof(Parse_shard));
+        pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+        int started = 0;
+
+        if (shards == NULL || workers == NULL) {
+            free(shards);
+            free(workers);
+            printf("Could not allocate %d parser shards.\n", threads);
+            return -1;
+        }
 
-        } else if (strcmp(token, "PREVLABEL") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].prevlabel, contents, sizeof(labels[i].prevlabel));
-                }
-            else
-                printf("Ignoring column \"%s\"\n", token);
+        for (int t = 0; t < threads; t++) {
+            shards[t].header = header;
+            shards[t].labels = labels;
+            shards[t].first = 1 + (int) ((long long) rows * t / threads);
+            shards[t].last = 1 + (int) ((long long) rows * (t + 1) / threads);
+            // at most one error (row, extra cells) per row
+            shards[t].errors = (int *) malloc(2 * (shards[t].last - shards[t].first) * sizeof(int));
+        }
 
-        } else if (strcmp(token, "PREVTEMPLATE") == 0) {
-            if (non_SAP_fields)
-                for (int i = 1; i < spreadsheet_row_number; i++) {
-                    get_field_contents_from_row(contents, i, count, tab_str);
-                    strlcpy(labels[i].prevtemplate, contents, sizeof(labels[i].prevtemplate));
-                }
+        // the first shard is parsed by the calling thread
+        for (int t = 1; t < threads; t++)
+            if (pthread_create(&workers[t], NULL, parse_shard, &shards[t]) == 0)
+                started = t;
             else
-                printf("Ignoring column \"%s\"\n", token);
-
-        } else if (strcmp(token, "PATENTSTA") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].patentstatement, contents, sizeof(labels[i].patentstatement));
-            }
-
-        } else if (strcmp(token, "PHTDEHP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].phtdehp = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "PHTBBP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].phtbbp = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "PHTDINP") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].phtdinp = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "PVCFREE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].pvcfree = graphic_type(contents);
-            }
-        } else if (strcmp(token, "QUANTITY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].quantity, contents, sizeof(labels[i].quantity));
-            }
-
-        } else if (strcmp(token, "REF") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].ref = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "REFNUMBER") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].refnumber = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "REUSABLE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].reusable = graphic_type(contents);
-            }
-        } else if (strcmp(token, "REVISION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].revision, contents, sizeof(labels[i].revision));
-            }
-
-        } else if (strcmp(token, "LABEL_RELEASE_DATE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].release, contents, sizeof(labels[i].release));
-            }
-
-        } else if (strcmp(token, "RXONLY") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].rxonly = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "SINGLEUSE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].singleuseonly = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "SERIAL") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].serial = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "SINGLEPATIENTUSE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].singlepatientuse = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "SIZE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].size, contents, sizeof(labels[i].size));
-            }
-
-        } else if (strcmp(token, "SIZELOGO") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].sizelogo = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "STERILITYTYPE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].sterilitytype, contents, sizeof(labels[i].sterilitytype));
-            }
-
-        } else if (strcmp(token, "STERILESTA") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].sterilitystatement, contents, sizeof(labels[i].sterilitystatement));
-            }
-
-        } else if (strcmp(token, "TEMPRANGE") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].temprange, contents, sizeof(labels[i].temprange));
-            }
-
-        } else if ((strcmp(token, "TEMPLATENUMBER") == 0) ||
-                (strcmp(token, "TEMPLATE") == 0)) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].template, contents, sizeof(labels[i].template));
-            }
-
-        } else if (strcmp(token, "TFXLOGO") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                labels[i].tfxlogo = graphic_type(contents);
-            }
-
-        } else if (strcmp(token, "VERSION") == 0) {
-            for (int i = 1; i < spreadsheet_row_number; i++) {
-                get_field_contents_from_row(contents, i, count, tab_str);
-                strlcpy(labels[i].version, contents, sizeof(labels[i].version));
-            }
-        } else {
-            if (strlen(token) > 0) {
-                if (strcmp(token, "CAUTIONSTATEMENT") == 0)
-                    printf("Change \"%s\" to \"CAUTIONSTATE.\" ", token);
-                printf("Ignoring column \"%s\"\n", token);
-            }
+                break;
+        parse_shard(&shards[0]);
+        for (int t = 1; t <= started; t++)
+            pthread_join(workers[t], NULL);
+        // shards no thread could be started for
+        for (int t = started + 1; t < threads; t++)
+            parse_shard(&shards[t]);
+
+        // the shards are consecutive, so their errors are reported in row order
+        for (int t = 0; t < threads; t++) {
+            for (int e = 0; e < shards[t].error_count; e += 2)
+                printf("Record %d has %d more cells than column headings. Extra cells ignored.\n",
+                       shards[t].errors[e], shards[t].errors[e + 1]);
+            free(shards[t].errors);
         }
-        count++;
-        free(token);
+        free(shards);
+        free(workers);
     }
+
     return count;
 }
 
@@ -783,6 +710,93 @@ int sort_labels(Label_record *labels) {
     return sorted;
 }
 
+/**
+    compares two records by MATERIAL, then by LABEL
+*/
+static int compare_material(const Label_record *a, const Label_record *b) {
+    int result = strcmp(a->material, b->material);
+    return result != 0 ? result : strcmp(a->label, b->label);
+}
+
+/**
+    merge sorts a range of record indexes; equal records keep their order
+    @param order holds the indexes to sort
+    @param scratch has room for as many indexes
+    @param count is the number of indexes
+*/
+static void merge_sort_order(const Label_record *labels, int *order, int *scratch, int count) {
+    if (count < 2)
+        return;
+
+    int half = count / 2;
+    merge_sort_order(labels, order, scratch, half);
+    merge_sort_order(labels, order + half, scratch, count - half);
+
+    // the halves are already in order
+    if (compare_material(&labels[order[half - 1]], &labels[order[half]]) <= 0)
+        return;
+
+    int i = 0, j = half, k = 0;
+    while (i < half && j < count)
+        scratch[k++] = compare_material(&labels[order[j]], &labels[order[i]]) < 0 ? order[j++] : order[i++];
+    while (i < half)
+        scratch[k++] = order[i++];
+    while (j < count)
+        scratch[k++] = order[j++];
+    memcpy(order, scratch, count * sizeof(int));
+}
+
+int sort_labels_by_material(Label_record *labels) {
+    int count = spreadsheet_row_number;
+    int *order = (int *) malloc(count * sizeof(int));
+    int *scratch = (int *) malloc(count * sizeof(int));
+
+    if (order == NULL || scratch == NULL) {
+        free(order);
+        free(scratch);
+        return -1;
+    }
+
+    // the records are sorted as indexes, and then moved once
+    for (int i = 0; i < count; i++)
+        order[i] = i;
+    merge_sort_order(labels, order + 1, scratch, count - 1);
+
+    // order[i] is the record that goes to i; each cycle needs one spare record
+    for (int i = 1; i < count; i++) {
+        if (order[i] == i)
+            continue;
+        Label_record spare = labels[i];
+        int j = i;
+        while (order[j] != i) {
+            int from = order[j];
+            labels[j] = labels[from];
+            order[j] = j;
+            j = from;
+        }
+        labels[j] = spare;
+        order[j] = j;
+    }
+
+    free(order);
+    free(scratch);
+    return 0;
+}
+
+int count_material_records(const Label_record *labels) {
+    const char *prev_material = "";
+    int count = 0;
+
+    // records without a material do not print one, nor reset the last one
+    for (int i = 1; i < spreadsheet_row_number; i++) {
+        if (labels[i].material[0] != '\0' && strcmp(prev_material, labels[i].material) != 0) {
+            prev_material = labels[i].material;
+            count++;
+        }
+    }
+    return count;
+}
+
 void swap_label_records(Label_record *labels, int i, int min_index) {
     Label_record temp = labels[i];
     labels[i] = labels[min_index];
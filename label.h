@@ -9,12 +9,20 @@
 #define LABEL_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* the spreadsheet's initial capacity */
 #define INITIAL_CAP             3
 
 #define MAX_COLUMNS          1000
 
+/* at least the number of recognized column headings */
+#define MAX_CELL_SLOTS         96
+
+/* the fewest rows worth a parser thread of their own */
+#define PARSE_SHARD_MIN       512
+
 /* Field lengths                     */
 #define LRG                    41
 #define MED                    30
@@ -43,6 +51,17 @@ extern int spreadsheet_row_number;
 /* whether or not to include non-SAP fields in IDoc                      */
 extern bool non_SAP_fields;
 
+/* the GTIN fields, decoded while parsing                               */
+enum gtin_field {
+    GTIN_BARCODETEXT, GTIN_GTIN, GTIN_BARCODE1, GTIN_GS1, GTIN_FIELDS
+};
+
+/** a GTIN field decoded while parsing                                   */
+typedef struct {
+    long long number;   /* the digits as a number, when there are at most 18 */
+    int digits;         /* the number of digits, 0 unless the field is all digits */
+} Gtin_value;
+
 /**
 
 */
@@ -96,50 +115,146 @@ typedef struct {
     char bomlevel[SML];
     char revision[MAX_REV_LEN];
     char release[MED2];
+    /* points into the spreadsheet row the record was parsed from          */
     char *tdline;
+    /* the size of that row as it was read, before parsing ended TDLINE   */
+    size_t row_bytes;
+
+    /* the cell class of each text field, by column slot (see field_slot) */
+    unsigned char cells[MAX_CELL_SLOTS];
 
-    unsigned int caution : 4;
-    unsigned int consultifu : 4;
-    unsigned int donotusedamaged : 4;
-    unsigned int electroifu : 4;
-    unsigned int keepdry : 4;
-    unsigned int latex : 4;
-    unsigned int latexfree : 4;
-    unsigned int maninbox : 4;
-    unsigned int nonsterile : 4;
-    unsigned int noresterilize : 4;
-    unsigned int pvcfree : 4;
-    unsigned int reusable : 4;
-    unsigned int singlepatientuse : 4;
-    unsigned int singleuseonly : 4;
-    unsigned int ecrep : 4;
-    unsigned int expdate : 4;
-    unsigned int keepawayheat : 4;
-    unsigned int lotgraphic : 4;
-    unsigned int manufacturer : 4;
-    unsigned int mfgdate : 4;
-    unsigned int phtbbp : 4;
-    unsigned int phtdehp : 4;
-    unsigned int phtdinp : 4;
-    unsigned int ref : 4;
-    unsigned int refnumber : 4;
-    unsigned int rxonly : 4;
-    unsigned int serial : 4;
-    unsigned int sizelogo : 4;
-    unsigned int tfxlogo : 4;
+    /* symbol columns: a bit per symbol that has a value, and the values
+       (N, Y, F_Y, ISO_Y less one) at two bits per symbol                */
+    uint32_t symbols_set;
+    uint64_t symbol_values;
+
+    /* typed values decoded from the text fields (see decode_fields)      */
+    int revision_number;        /* the n of "R<n>" (0 - 99), or -1        */
+    int release_date;           /* the leading integer, or 0              */
+    Gtin_value gtins[GTIN_FIELDS];
 
 } Label_record;
 
+/* symbol columns, in the order their IDoc records are printed          */
+enum symbol {
+    SYM_CAUTION, SYM_CONSULTIFU, SYM_LATEX, SYM_DONOTUSEDAMAGED, SYM_LATEXFREE,
+    SYM_MANINBOX, SYM_NORESTERILIZE, SYM_NONSTERILE, SYM_PVCFREE, SYM_REUSABLE,
+    SYM_SINGLEUSEONLY, SYM_SINGLEPATIENTUSE, SYM_ELECTROIFU, SYM_KEEPDRY,
+    SYM_ECREP, SYM_EXPDATE, SYM_KEEPAWAYHEAT, SYM_LOTGRAPHIC, SYM_MANUFACTURER,
+    SYM_MFGDATE, SYM_PHTDEHP, SYM_PHTBBP, SYM_PHTDINP, SYM_REFNUMBER, SYM_REF,
+    SYM_RXONLY, SYM_SERIAL, SYM_TFXLOGO, SYM_SIZELOGO, SYM_COUNT
+};
+
+/* the symbols printed as GRAPHIC01 - GRAPHIC14 records, and the symbols
+   printed as records of their own                                      */
+#define GRAPHIC_SYMBOLS     ((1u << (SYM_KEEPDRY + 1)) - 1)
+#define BOOLEAN_SYMBOLS     (((1u << (SYM_TFXLOGO + 1)) - 1) & ~GRAPHIC_SYMBOLS)
+
+/* the values a cell is classified as while it is parsed; the Y / N
+   classes equal the symbol values stored for graphic columns           */
+enum cell_class {
+    CELL_EMPTY,         /* an empty cell                                  */
+    CELL_N,             /* N / NO                                         */
+    CELL_Y,             /* Y / YES                                        */
+    CELL_F_Y,           /* F_Y / F_YES                                    */
+    CELL_ISO_Y,         /* ISO_Y / ISO_YES                                */
+    CELL_NA,            /* N/A                                            */
+    CELL_TEXT           /* anything else                                  */
+};
+
+/* how a column's cells are stored in the Label_record                   */
+enum field_kind {
+    FIELD_TEXT,         /* copied into a fixed length text field          */
+    FIELD_TEXT_SET,     /* copied unless the cell is empty, "N" or "NO"   */
+    FIELD_TDLINE,       /* copied into a dynamically allocated field      */
+    FIELD_SYMBOL,       /* Y / N / F_Y / ISO_Y graphic symbol             */
+    FIELD_YES           /* symbol that is only ever set by Y / Yes        */
+};
+
+/** a recognized spreadsheet column and the Label_record field it fills  */
+typedef struct {
+    const char *name;
+    int kind;
+    size_t offset;
+    size_t size;
+    int symbol;
+    bool non_SAP;
+} Column_def;
+
+/** Recognized spreadsheet column headings, aliases after the heading
+    they stand in for                                                    */
+extern const Column_def column_defs[];
+extern const int column_defs_size;
+
+/** the resolved column headings of a spreadsheet: one definition per
+    column, NULL for columns that are ignored                            */
+typedef struct {
+    int count;
+    /* one past the last column that is read; the cells after it are only
+       counted                                                           */
+    int last;
+    const Column_def *columns[MAX_COLUMNS];
+    int slots[MAX_COLUMNS];
+} Sheet_header;
+
+/**
+    returns the slot of a text field in Label_record.cells: the index of the
+    first column heading that fills it
+    @param offset is the offset of the field in Label_record
+    @return the slot, or -1 if no column fills the field
+*/
+int field_slot(size_t offset);
+
+/**
+    returns the slot of a column's cell class in Label_record.cells
+    @param def is the column definition, or NULL
+    @return the slot, or -1 for symbol and ignored columns
+*/
+int column_slot(const Column_def *def);
+
 int duplicate_column_names(const char *column_names);
 
 /**
-    identifies the column headings in a line and assigns true values to the
-    elements in the Column_header struct that correspond to those elements.
+    resolves the column headings line into column definitions, reporting
+    ignored and substituted columns.
+    @param buffer is the column headings line
+    @param header receives the column definitions
+    @return the number of columns, or -1 if the headings are inconsistent
+*/
+int parse_header(const char *buffer, Sheet_header *header);
+
+/**
+    moves the cells of one spreadsheet row into a label record, using the
+    column definitions resolved by parse_header. Ignored cells are skipped
+    without being copied, and the TDLINE cell is terminated in place, so
+    the row must outlive the record.
+    @param header contains the column definitions
+    @param row is the spreadsheet row
+    @param label is the (zeroed) label record to fill
+    @return the number of non-blank cells past the last column heading
+*/
+int parse_row(const Sheet_header *header, char *row, Label_record *label);
+
+/**
+    decodes the REVISION, LABEL_RELEASE_DATE and GTIN text fields of a
+    label record into its typed values, so printing does not parse them
+    again. The parsers do not depend on the locale.
+    @param label is the label record
+*/
+void decode_fields(Label_record *label);
+
+/**
+    resolves the column headings and parses the spreadsheet rows into label
+    records. The rows are split into consecutive shards parsed by separate
+    threads; rows with more cells than column headings are reported in row
+    order once all shards are done.
     @param buffer is a pointer to the column headings line
-    @param cols is a pointer to a Column_header struct
-    @return the number of column headings identified
+    @param header receives the resolved column headings
+    @param labels is the (zeroed) label record array
+    @param threads is the maximum number of parser threads
+    @return the number of column headings, or -1 if they are inconsistent
 */
-int parse_spreadsheet(char *buffer, Label_record *labels);
+int parse_spreadsheet(char *buffer, Sheet_header *header, Label_record *labels, int threads);
 
 /**
     get_token dynamically allocates a text substring and copies the substring
@@ -157,16 +272,24 @@ int parse_spreadsheet(char *buffer, Label_record *labels);
 char *get_token(char *buffer, char tab_str);
 
 /**
- * Given a specific delimiter, extracts the value of that field with a delimited char string.
- * Returns the length of that value if it exists and isn't "N" or "NO"
- * @param contents
- * @param i
- * @param count
- * @param tab_str
- * @return
+ * Copies a cell into a field, removing any .tif extension.
+ * @param contents receives the cell value
+ * @param size is the size of contents
+ * @param cell points to the start of the cell
+ * @param length is the length of the cell
+ * @return the cell class of the copied value
  */
 
-int get_field_contents_from_row(char *contents, int i, int count, char tab_str);
+int get_cell_contents(char *contents, size_t size, const char *cell, int length);
+
+/**
+    classifies a cell value as empty, one of the Y / N values, N/A or text
+    (case insensitive)
+    @param cell is the cell value
+    @param length is the length of the value
+    @return the cell class
+*/
+int classify_cell(const char *cell, size_t length);
 
 int peek_nth_token(int n, const char *buffer, char delimiter);
 
@@ -176,12 +299,35 @@ int equals_yes(char *field);
 
 int equals_no(char *field);
 
+int graphic_type(char *field);
+
+void set_symbol(Label_record *label, int symbol, unsigned int value);
+
+unsigned int get_symbol(const Label_record *label, int symbol);
+
 int spreadsheet_init();
 
 int spreadsheet_expand();
 
 int sort_labels(Label_record *labels);
 
+/**
+    sorts the label records by MATERIAL and then by LABEL, so that the
+    records of one material follow a single MATERIAL record. The sort is
+    stable: records with the same material and label keep their order.
+    @param labels is the array of label records, sorted by LABEL
+    @return 0 if successful, -1 if memory could not be allocated
+*/
+int sort_labels_by_material(Label_record *labels);
+
+/**
+    counts the MATERIAL records the IDoc will contain: one for every record
+    whose material differs from the last material printed
+    @param labels is the array of label records in printing order
+    @return the number of MATERIAL records
+*/
+int count_material_records(const Label_record *labels);
+
 void swap_label_records(Label_record *labels, int i, int min_index);
 
 #endif
\ No newline at end of file
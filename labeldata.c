@@ -0,0 +1,275 @@
+/**
+ *  labeldata.c
+ */
+#include "labeldata.h"
+#include "text.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the label data file name suffixes                                     */
+#define CSV_SUFFIX     "_labeldata.csv"
+#define BIN_SUFFIX     "_labeldata.bin"
+
+/* initial capacity of a column, doubled as needed                       */
+#define COLUMN_INITIAL_CAP   256
+
+/** a column of the binary file, grown as records are added              */
+typedef struct {
+    const Column_def *def;
+    char *bytes;
+    size_t length;
+    size_t cap;
+    uint32_t *offsets;
+} Label_column;
+
+struct Label_data {
+    FILE *csv;
+    FILE *bin;
+    int count;
+    uint32_t rows;
+    uint32_t rows_cap;
+    char *text;             // the unquoted value of the current cell
+    size_t text_cap;
+    Label_column columns[MAX_COLUMNS];
+};
+
+/** the spreadsheet values of the symbol codes                           */
+static const char *symbol_values[] = {"", "N", "Y", "F_Y", "ISO_Y"};
+
+/**
+    returns true if an earlier column definition fills the same field, so
+    that aliases such as PCODE or CE0120 are exported once
+*/
+static int is_alias(int i) {
+    for (int j = 0; j < i; j++) {
+        if (column_defs[i].kind == FIELD_SYMBOL || column_defs[i].kind == FIELD_YES) {
+            if ((column_defs[j].kind == FIELD_SYMBOL || column_defs[j].kind == FIELD_YES) &&
+                column_defs[j].symbol == column_defs[i].symbol)
+                return 1;
+        } else if (column_defs[j].kind != FIELD_SYMBOL && column_defs[j].kind != FIELD_YES &&
+                   column_defs[j].offset == column_defs[i].offset)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+    copies the lines of unquoted TDLINE text, joined by line breaks, with
+    every run of quotes collapsed into a single quote as they are printed
+    @return the length of the copy
+*/
+static size_t copy_lines(char *dest, const char *tdline) {
+    const char *cursor, *end;
+    Text_slice line;
+    size_t i = 0;
+
+    text_unquote_bounds(tdline, &cursor, &end);
+    while (text_next_line(&cursor, end, &line)) {
+        for (const char *c = line.start; c < line.end; c++) {
+            dest[i++] = *c;
+            if (*c == '\"')
+                while (c + 1 < line.end && c[1] == '\"')
+                    c++;
+        }
+        if (line.line_break)
+            dest[i++] = '\n';
+    }
+    dest[i] = '\0';
+    return i;
+}
+
+/**
+    returns the value of a text column in a label record as the IDoc holds
+    it: without the quotes of Excel's text export, and with the TDLINE
+    lines on lines of their own
+    @param length receives the length of the value
+    @return the value, valid until the next call, or NULL if out of memory
+*/
+static const char *column_text(Label_data *data, const Label_column *column, const Label_record *label,
+                               size_t *length) {
+    const char *text = (const char *) label + column->def->offset;
+
+    if (column->def->kind == FIELD_TDLINE)
+        text = label->tdline ? label->tdline : "";
+
+    // the value is never longer than the cell
+    size_t size = strlen(text) + 1;
+    if (size > data->text_cap) {
+        char *grown = (char *) realloc(data->text, size);
+        if (grown == NULL)
+            return NULL;
+        data->text = grown;
+        data->text_cap = size;
+    }
+
+    if (column->def->kind == FIELD_TDLINE)
+        *length = copy_lines(data->text, text);
+    else
+        *length = text_unquote(data->text, size, text, true);
+    return data->text;
+}
+
+/**
+    prints a CSV cell, quoting it if it contains a comma, quote or line break
+*/
+static void print_csv_cell(FILE *fp, const char *cell) {
+    if (strpbrk(cell, ",\"\r\n") == NULL) {
+        fputs(cell, fp);
+        return;
+    }
+    fputc('"', fp);
+    for (const char *c = cell; *c; c++) {
+        if (*c == '"')
+            fputc('"', fp);
+        fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+Label_data *labeldata_open(const char *base) {
+    Label_data *data = (Label_data *) calloc(1, sizeof(Label_data));
+    char *path = (char *) malloc(strlen(base) + strlen(CSV_SUFFIX) + 1);
+
+    if (data == NULL || path == NULL) {
+        free(data);
+        free(path);
+        return NULL;
+    }
+
+    sprintf(path, "%s%s", base, CSV_SUFFIX);
+    data->csv = fopen(path, "w");
+    sprintf(path, "%s%s", base, BIN_SUFFIX);
+    data->bin = fopen(path, "wb");
+    free(path);
+
+    if (data->csv == NULL || data->bin == NULL) {
+        if (data->csv)
+            fclose(data->csv);
+        if (data->bin)
+            fclose(data->bin);
+        free(data);
+        return NULL;
+    }
+
+    for (int i = 0; i < column_defs_size; i++)
+        if (!is_alias(i))
+            data->columns[data->count++].def = &column_defs[i];
+
+    // CSV heading row
+    for (int c = 0; c < data->count; c++) {
+        if (c > 0)
+            fputc(',', data->csv);
+        print_csv_cell(data->csv, data->columns[c].def->name);
+    }
+    fputc('\n', data->csv);
+    return data;
+}
+
+int labeldata_add(Label_data *data, const Label_record *label) {
+
+    // grow the offsets (or symbol bytes) of every column together
+    if (data->rows + 1 >= data->rows_cap) {
+        uint32_t cap = data->rows_cap ? data->rows_cap * 2 : COLUMN_INITIAL_CAP;
+        for (int c = 0; c < data->count; c++) {
+            uint32_t *offsets = (uint32_t *) realloc(data->columns[c].offsets, (cap + 1) * sizeof(uint32_t));
+            if (offsets == NULL)
+                return -1;
+            if (data->rows_cap == 0)
+                offsets[0] = 0;
+            data->columns[c].offsets = offsets;
+        }
+        data->rows_cap = cap;
+    }
+
+    for (int c = 0; c < data->count; c++) {
+        Label_column *column = &data->columns[c];
+        const char *text;
+        size_t length;
+        char symbol;
+
+        if (column->def->kind == FIELD_SYMBOL || column->def->kind == FIELD_YES) {
+            unsigned int value = get_symbol(label, column->def->symbol);
+            symbol = (char) (value < 5 ? value : 1);
+            text = &symbol;
+            length = 1;
+        } else if (column->def->non_SAP && !non_SAP_fields) {
+            // the records hold the non-SAP fields, but they are only exported with -n
+            text = "";
+            length = 0;
+        } else {
+            if ((text = column_text(data, column, label, &length)) == NULL)
+                return -1;
+        }
+
+        if (column->length + length > column->cap) {
+            size_t cap = column->cap ? column->cap : COLUMN_INITIAL_CAP;
+            while (column->length + length > cap)
+                cap *= 2;
+            char *bytes = (char *) realloc(column->bytes, cap);
+            if (bytes == NULL)
+                return -1;
+            column->bytes = bytes;
+            column->cap = cap;
+        }
+        memcpy(column->bytes + column->length, text, length);
+        column->length += length;
+        column->offsets[data->rows + 1] = (uint32_t) column->length;
+
+        if (c > 0)
+            fputc(',', data->csv);
+        if (column->def->kind == FIELD_SYMBOL || column->def->kind == FIELD_YES)
+            fputs(symbol_values[(int) symbol], data->csv);
+        else
+            print_csv_cell(data->csv, text);
+    }
+    fputc('\n', data->csv);
+    data->rows++;
+    return ferror(data->csv) ? -1 : 0;
+}
+
+int labeldata_close(Label_data *data) {
+    uint32_t version = LABELDATA_VERSION;
+    uint32_t columns = (uint32_t) data->count;
+    int status = 0;
+
+    fwrite("STOILBL", 1, 8, data->bin);
+    fwrite(&version, sizeof(version), 1, data->bin);
+    fwrite(&columns, sizeof(columns), 1, data->bin);
+    fwrite(&data->rows, sizeof(data->rows), 1, data->bin);
+
+    for (int c = 0; c < data->count; c++) {
+        const char *name = data->columns[c].def->name;
+        int kind = data->columns[c].def->kind;
+        unsigned char type = (kind == FIELD_SYMBOL || kind == FIELD_YES) ? LABELDATA_SYMBOL : LABELDATA_TEXT;
+        unsigned char name_length = (unsigned char) strlen(name);
+        fputc(type, data->bin);
+        fputc(name_length, data->bin);
+        fwrite(name, 1, name_length, data->bin);
+    }
+
+    for (int c = 0; c < data->count; c++) {
+        Label_column *column = &data->columns[c];
+        int kind = column->def->kind;
+        if (kind != FIELD_SYMBOL && kind != FIELD_YES) {
+            uint32_t empty = 0;
+            if (data->rows > 0)
+                fwrite(column->offsets, sizeof(uint32_t), data->rows + 1, data->bin);
+            else
+                fwrite(&empty, sizeof(empty), 1, data->bin);
+        }
+        if (column->length > 0)
+            fwrite(column->bytes, 1, column->length, data->bin);
+        free(column->bytes);
+        free(column->offsets);
+    }
+
+    if (ferror(data->bin) || fclose(data->bin) != 0)
+        status = -1;
+    if (ferror(data->csv) || fclose(data->csv) != 0)
+        status = -1;
+    free(data->text);
+    free(data);
+    return status;
+}
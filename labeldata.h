@@ -0,0 +1,57 @@
+/**
+    @file labeldata.h
+    Together with labeldata.c, this component is responsible for the -L
+    "Label Data" side output: the parsed label records written as CSV and
+    as a compact columnar binary file, in the same pass as the IDoc.
+
+    The binary file (native byte order) is laid out as
+        char     magic[8]       "STOILBL" and a null character
+        uint32   version        LABELDATA_VERSION
+        uint32   columns
+        uint32   rows
+        columns x { uint8 type, uint8 name length, name }
+        columns x data
+    where the data of a text column (type 0) is rows + 1 uint32 offsets
+    followed by the concatenated cell bytes, and the data of a symbol
+    column (type 1) is one byte per row: 0 empty, 1 N, 2 Y, 3 F_Y, 4 ISO_Y.
+*/
+
+#ifndef STOIDOC_LABELDATA_H
+#define STOIDOC_LABELDATA_H
+
+#include "label.h"
+
+/* version of the columnar binary format                                 */
+#define LABELDATA_VERSION       1
+
+/* column types of the columnar binary format                            */
+#define LABELDATA_TEXT          0
+#define LABELDATA_SYMBOL        1
+
+/** the open label data files and the columns collected so far           */
+typedef struct Label_data Label_data;
+
+/**
+    creates <base>_labeldata.csv and <base>_labeldata.bin
+    @param base is the input file name without its extension
+    @return the label data output, or NULL if the files cannot be created
+*/
+Label_data *labeldata_open(const char *base);
+
+/**
+    adds a label record: its CSV row is written immediately, its cells are
+    appended to the columns of the binary file
+    @param data is the label data output
+    @param label is the label record
+    @return 0 if successful, -1 if unsuccessful
+*/
+int labeldata_add(Label_data *data, const Label_record *label);
+
+/**
+    writes the columnar binary file and closes both files
+    @param data is the label data output
+    @return 0 if successful, -1 if unsuccessful
+*/
+int labeldata_close(Label_data *data);
+
+#endif //STOIDOC_LABELDATA_H
@@ -0,0 +1,212 @@
+/**
+ *  mapout.c
+ */
+#define _GNU_SOURCE
+#include "mapout.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** a range of records printed by one writer into its region of the file */
+typedef struct {
+    const Emit_plan *plan;
+    Label_record *labels;
+    int first;
+    int last;
+    char *region;
+    size_t size;
+    size_t filled;
+    Ctrl start;
+    bool control;
+    int status;
+} Writer;
+
+/**
+    the write function of the byte counter: counts the bytes and drops them
+*/
+static ssize_t count_bytes(void *cookie, const char *buf, size_t size) {
+    (void) buf;
+    *(size_t *) cookie += size;
+    return (ssize_t) size;
+}
+
+/**
+    the write function of a writer's region: copies the bytes into the
+    mapping, refusing any that would overrun the region
+*/
+static ssize_t fill_region(void *cookie, const char *buf, size_t size) {
+    Writer *writer = (Writer *) cookie;
+
+    if (size > writer->size - writer->filled)
+        return -1;
+    memcpy(writer->region + writer->filled, buf, size);
+    writer->filled += size;
+    return (ssize_t) size;
+}
+
+/**
+    prints the records of a writer into its region of the mapped file,
+    starting from the sequence numbers measured for its first record
+    @param arg is the Writer
+    @return NULL
+*/
+static void *write_region(void *arg) {
+    Writer *writer = (Writer *) arg;
+    Ctrl idoc = writer->start;
+    FILE *fp;
+
+    writer->status = -1;
+    if (writer->size == 0) {
+        writer->status = 0;
+        return NULL;
+    }
+    if ((fp = fopencookie(writer, "w", (cookie_io_functions_t) {NULL, fill_region, NULL, NULL})) == NULL)
+        return NULL;
+
+    idoc.replay = true;
+    if (writer->control && print_control_record(fp, &idoc) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    for (int i = writer->first; i < writer->last; i++)
+        if (!print_label_idoc_records(fp, writer->plan, &writer->labels[i], i, &idoc)) {
+            fclose(fp);
+            return NULL;
+        }
+
+    // the region must have been filled exactly
+    if (fclose(fp) == 0 && writer->filled == writer->size)
+        writer->status = 0;
+    return NULL;
+}
+
+/**
+    creates a file of a given size and maps it for writing
+    @param path is the name of the file
+    @param size is the size of the file
+    @return the mapping, or NULL if the file could not be created
+*/
+static char *map_file(const char *path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    char *map;
+
+    if (fd == -1)
+        return NULL;
+
+    // allocate the blocks up front; file systems without fallocate are just extended
+    int error = posix_fallocate(fd, 0, (off_t) size);
+    if (error == EINVAL || error == EOPNOTSUPP)
+        error = ftruncate(fd, (off_t) size);
+    if (error != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    map = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+int mapout_write(const char *path, const Emit_plan *plan, Label_record *labels, int rows,
+                 Label_data *labeldata, int workers, Ctrl *idoc) {
+    size_t total = 0;
+    size_t *offsets;
+    Writer *writers;
+    FILE *counter;
+    int records = rows - 1;
+    int status = 0;
+
+    // small sheets are not worth a writer per record
+    if (workers > records)
+        workers = records;
+    if (workers < 1)
+        workers = 1;
+
+    writers = (Writer *) calloc(workers, sizeof(Writer));
+    offsets = (size_t *) calloc(workers + 1, sizeof(size_t));
+    counter = fopencookie(&total, "w", (cookie_io_functions_t) {NULL, count_bytes, NULL, NULL});
+    if (writers == NULL || offsets == NULL || counter == NULL) {
+        free(writers);
+        free(offsets);
+        if (counter != NULL)
+            fclose(counter);
+        return -1;
+    }
+
+    for (int t = 0; t < workers; t++) {
+        writers[t].plan = plan;
+        writers[t].labels = labels;
+        writers[t].first = 1 + (int) ((long long) records * t / workers);
+        writers[t].last = 1 + (int) ((long long) records * (t + 1) / workers);
+    }
+
+    // measure the records in order, noting where each writer starts
+    writers[0].start = *idoc;
+    writers[0].control = true;
+    print_control_record(counter, idoc);
+
+    for (int i = 1, t = 1; i < rows && status == 0; i++) {
+        if (t < workers && i == writers[t].first) {
+            fflush(counter);
+            offsets[t] = total;
+            writers[t++].start = *idoc;
+        }
+        if (labeldata && labeldata_add(labeldata, &labels[i]) != 0) {
+            printf("Could not write label data, line %d. Aborting.\n", i);
+            status = -1;
+        } else if (!print_label_idoc_records(counter, plan, &labels[i], i, idoc)) {
+            printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", i);
+            status = -1;
+        }
+    }
+    fclose(counter);
+    offsets[workers] = total;
+
+    char *map = status == 0 ? map_file(path, total) : NULL;
+    if (status == 0 && map == NULL) {
+        printf("Could not open output file %s\n", path);
+        status = -1;
+    }
+
+    if (status == 0) {
+        pthread_t *threads = (pthread_t *) malloc(workers * sizeof(pthread_t));
+        int started = 0;
+
+        for (int t = 0; t < workers; t++) {
+            writers[t].region = map + offsets[t];
+            writers[t].size = offsets[t + 1] - offsets[t];
+        }
+
+        // the first region is printed by the calling thread
+        for (int t = 1; threads != NULL && t < workers; t++)
+            if (pthread_create(&threads[t], NULL, write_region, &writers[t]) == 0)
+                started = t;
+            else
+                break;
+        write_region(&writers[0]);
+        for (int t = 1; t <= started; t++)
+            pthread_join(threads[t], NULL);
+        // regions no thread could be started for
+        for (int t = started + 1; t < workers; t++)
+            write_region(&writers[t]);
+
+        for (int t = 0; t < workers; t++)
+            if (writers[t].status != 0)
+                status = -1;
+        if (munmap(map, total) != 0 || status != 0) {
+            printf("Could not write output file %s\n", path);
+            status = -1;
+        }
+        free(threads);
+    }
+
+    free(writers);
+    free(offsets);
+    return status;
+}
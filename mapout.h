@@ -0,0 +1,35 @@
+/**
+    @file mapout.h
+    Together with mapout.c, this component is responsible for writing the
+    IDoc file of a parsed spreadsheet through a shared memory mapping: the
+    records are measured first, the file is allocated at its final size,
+    and writer threads print their ranges of records straight into it.
+*/
+
+#ifndef STOIDOC_MAPOUT_H
+#define STOIDOC_MAPOUT_H
+
+#include "idoc.h"
+#include "label.h"
+#include "labeldata.h"
+
+/**
+    writes the IDoc file of the label records. A first pass prints the
+    control record and the label records, in order, into a byte counter:
+    it reports every problem found, adds the label data and records the
+    offset and sequence numbers each writer starts from. The file is then
+    allocated, mapped, and the writers print their ranges of records into
+    it concurrently without reporting anything again.
+    @param path is the name of the IDoc file
+    @param plan is the emission plan of the sheet
+    @param labels is the label record array, the records starting at index 1
+    @param rows is the size of the label record array
+    @param labeldata is the label data output, or NULL
+    @param workers is the number of writer threads
+    @param idoc contains the sequence and control numbers
+    @return 0 if successful, -1 otherwise
+*/
+int mapout_write(const char *path, const Emit_plan *plan, Label_record *labels, int rows,
+                 Label_data *labeldata, int workers, Ctrl *idoc);
+
+#endif //STOIDOC_MAPOUT_H
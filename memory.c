@@ -0,0 +1,74 @@
+/**
+ *  memory.c
+ */
+#include "memory.h"
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the total is kept as one more account                                 */
+#define MEM_TOTAL      MEM_ACCOUNTS
+
+/* the accounts, their peaks and the budget                              */
+static atomic_llong used[MEM_ACCOUNTS + 1];
+static atomic_llong peak[MEM_ACCOUNTS + 1];
+static long long budget = 0;
+
+static const char *account_names[MEM_ACCOUNTS] = {"rows", "records", "TDLINE", "lookup"};
+
+/**
+    raises the peak of an account to a new level
+*/
+static void raise_peak(int account, long long level) {
+    long long seen = atomic_load(&peak[account]);
+    while (level > seen && !atomic_compare_exchange_weak(&peak[account], &seen, level));
+}
+
+void memory_charge(int account, long long bytes) {
+    raise_peak(account, atomic_fetch_add(&used[account], bytes) + bytes);
+    raise_peak(MEM_TOTAL, atomic_fetch_add(&used[MEM_TOTAL], bytes) + bytes);
+}
+
+void memory_move(int from, int to, long long bytes) {
+    atomic_fetch_sub(&used[from], bytes);
+    raise_peak(to, atomic_fetch_add(&used[to], bytes) + bytes);
+}
+
+void memory_set_budget(long long bytes) {
+    budget = bytes;
+}
+
+bool memory_fits(long long bytes) {
+    return budget == 0 || atomic_load(&used[MEM_TOTAL]) + bytes <= budget;
+}
+
+long long memory_parse_size(const char *text) {
+    char *end;
+    long long size = strtoll(text, &end, 10);
+
+    if (end == text || size <= 0)
+        return -1;
+    switch (toupper((unsigned char) *end)) {
+        case 'G':
+            size *= 1024;
+            // fall through
+        case 'M':
+            size *= 1024;
+            // fall through
+        case 'K':
+            size *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    return *end == '\0' ? size : -1;
+}
+
+void memory_report(void) {
+    printf("Peak memory:");
+    for (int a = 0; a < MEM_ACCOUNTS; a++)
+        printf(" %s %lld KB,", account_names[a], (atomic_load(&peak[a]) + 1023) / 1024);
+    printf(" total %lld KB\n", (atomic_load(&peak[MEM_TOTAL]) + 1023) / 1024);
+}
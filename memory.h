@@ -0,0 +1,64 @@
+/**
+    @file memory.h
+    Together with memory.c, this component is responsible for accounting
+    the memory held by each part of the converter and for the --max-memory
+    budget: a sheet that would not fit is streamed instead of buffered.
+*/
+
+#ifndef STOIDOC_MEMORY_H
+#define STOIDOC_MEMORY_H
+
+#include <stdbool.h>
+
+/* the parts of the converter whose memory is accounted                  */
+enum memory_account {
+    MEM_ROWS,       // the spreadsheet rows, less their TDLINE text
+    MEM_RECORDS,    // the label records
+    MEM_TDLINE,     // the TDLINE text of the buffered rows
+    MEM_LOOKUP,     // the rendered record tails and the graphics index
+    MEM_ACCOUNTS
+};
+
+/**
+    adds to the memory held by a part of the converter. Any thread may
+    charge memory.
+    @param account is the part of the converter
+    @param bytes is the memory allocated, or negative for memory released
+*/
+void memory_charge(int account, long long bytes);
+
+/**
+    moves memory from one account to another, as when the TDLINE text of
+    a row is found
+    @param from is the account charged so far
+    @param to is the account to charge instead
+    @param bytes is the memory moved
+*/
+void memory_move(int from, int to, long long bytes);
+
+/**
+    sets the memory budget
+    @param bytes is the budget, or 0 for none
+*/
+void memory_set_budget(long long bytes);
+
+/**
+    reports whether more memory can be allocated within the budget
+    @param bytes is the memory about to be allocated
+    @return true if there is no budget or the memory fits within it
+*/
+bool memory_fits(long long bytes);
+
+/**
+    translates a --max-memory= size such as "512M" into bytes
+    @param text is a number, optionally followed by K, M or G
+    @return the size in bytes, or -1 if the size is not recognized
+*/
+long long memory_parse_size(const char *text);
+
+/**
+    prints the peak memory of every account and of the total
+*/
+void memory_report(void);
+
+#endif //STOIDOC_MEMORY_H
@@ -0,0 +1,316 @@
+/**
+ *  pipeline.c
+ */
+#include "pipeline.h"
+#include "duplicates.h"
+#include "memory.h"
+#include "queue.h"
+#include "reader.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* capacity of the queues between the stages                             */
+#define QUEUE_CAP           1024
+
+/* maximum number of rows between the reader and the writer; bounds the
+   memory used and the size of the writer's reordering window            */
+#define WINDOW        (4 * QUEUE_CAP)
+
+/** a spreadsheet row on its way through the pipeline                    */
+typedef struct {
+    int record;
+    int extra_cells;
+    char *row;
+    size_t bytes;           // the memory of the row, charged to MEM_ROWS
+    Label_record label;
+} Pipeline_item;
+
+/** the state shared by the stages                                       */
+typedef struct {
+    FILE *fp;
+    char **buffered;        // rows read before the pipeline started, streamed first
+    int buffered_count;
+    int buffered_next;
+    const Sheet_header *header;
+    const Emit_plan *plan;
+    Queue rows;
+    Queue parsed;
+    atomic_int next_record;
+    atomic_bool stop;
+} Pipeline;
+
+/**
+    waits a little longer each time a queue is found full or empty:
+    spin first, then yield, then sleep
+    @param spins counts the unsuccessful attempts so far
+*/
+static void backoff(int *spins) {
+    if (++(*spins) < 64)
+        return;
+    else if (*spins < 128)
+        sched_yield();
+    else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/**
+    pushes an item, waiting while the queue is full
+    @return false if the pipeline was stopped before the item was pushed
+*/
+static bool push_wait(Pipeline *p, Queue *q, void *data) {
+    int spins = 0;
+    while (!queue_try_push(q, data)) {
+        if (atomic_load(&p->stop))
+            return false;
+        backoff(&spins);
+    }
+    return true;
+}
+
+/**
+    pops an item, waiting while the queue is empty
+    @return false if the pipeline was stopped before an item arrived
+*/
+static bool pop_wait(Pipeline *p, Queue *q, void **data) {
+    int spins = 0;
+    while (!queue_try_pop(q, data)) {
+        if (atomic_load(&p->stop))
+            return false;
+        backoff(&spins);
+    }
+    return true;
+}
+
+static void free_item(Pipeline_item *item) {
+    if (item != NULL) {
+        // the TDLINE of the label points into the row
+        free(item->row);
+        memory_charge(MEM_ROWS, -(long long) item->bytes);
+        free(item);
+    }
+}
+
+/**
+    takes the next row: a buffered one while there are any, then one
+    read from the input
+    @param bytes receives the memory of the row
+    @return the row, or NULL at the end of the input
+*/
+static char *next_row(Pipeline *p, size_t *bytes) {
+    char *row;
+
+    if (p->buffered_next < p->buffered_count) {
+        row = p->buffered[p->buffered_next++];
+        // buffered rows were charged when they were read
+        *bytes = strlen(row) + 1;
+    } else if ((row = read_row(p->fp)) != NULL) {
+        *bytes = strlen(row) + 1;
+        memory_charge(MEM_ROWS, (long long) *bytes);
+    }
+    return row;
+}
+
+/**
+    reader stage: splits the input into rows and numbers them
+    @param arg is the Pipeline
+    @return NULL
+*/
+static void *reader_thread(void *arg) {
+    Pipeline *p = (Pipeline *) arg;
+    int record = 1;
+    size_t bytes = 0;
+    char *row;
+
+    while (!atomic_load(&p->stop) && (row = next_row(p, &bytes)) != NULL) {
+        int spins = 0;
+        while (record - atomic_load(&p->next_record) >= WINDOW && !atomic_load(&p->stop))
+            backoff(&spins);
+
+        Pipeline_item *item = (Pipeline_item *) calloc(1, sizeof(Pipeline_item));
+        if (item == NULL) {
+            free(row);
+            memory_charge(MEM_ROWS, -(long long) bytes);
+            break;
+        }
+        item->record = record++;
+        item->row = row;
+        item->bytes = bytes;
+        if (!push_wait(p, &p->rows, item)) {
+            free_item(item);
+            break;
+        }
+    }
+
+    // a NULL item tells the parser threads that the rows have run out
+    push_wait(p, &p->rows, NULL);
+    return NULL;
+}
+
+/**
+    parser stage: fills the label record of each row
+    @param arg is the Pipeline
+    @return NULL
+*/
+static void *parser_thread(void *arg) {
+    Pipeline *p = (Pipeline *) arg;
+    // stays non-NULL if the pipeline is stopped before any row is read
+    void *data = p;
+
+    while (pop_wait(p, &p->rows, &data) && data != NULL) {
+        Pipeline_item *item = (Pipeline_item *) data;
+        item->extra_cells = parse_row(p->header, item->row, &item->label);
+        if (!push_wait(p, &p->parsed, item)) {
+            free_item(item);
+            return NULL;
+        }
+    }
+
+    // pass the end of the rows on to the writer, and to the other parsers
+    if (data == NULL) {
+        push_wait(p, &p->rows, NULL);
+        push_wait(p, &p->parsed, NULL);
+    }
+    return NULL;
+}
+
+/**
+    writer stage: prints the parsed records in row order
+    @param p is the Pipeline
+    @param fpout points to the IDoc file
+    @param labeldata is the label data output, or NULL
+    @param workers is the number of parser threads running
+    @param idoc contains the sequence and control numbers
+    @return 0 if successful, -1 otherwise
+*/
+static int write_records(Pipeline *p, FILE *fpout, Label_data *labeldata, int workers, Ctrl *idoc) {
+    Pipeline_item **pending = (Pipeline_item **) calloc(WINDOW, sizeof(Pipeline_item *));
+    char prev_label[MAX_LABEL_LEN] = {0};
+    int first = 0;          // the first record of prev_label
+    int next = 1;
+    int finished = 0;
+    int status = -1;
+    void *data;
+
+    if (pending == NULL)
+        return -1;
+
+    // every parser thread sends a NULL item once the rows have run out
+    while (finished < workers && pop_wait(p, &p->parsed, &data)) {
+        if (data == NULL) {
+            finished++;
+        } else {
+            Pipeline_item *item = (Pipeline_item *) data;
+            pending[item->record % WINDOW] = item;
+        }
+
+        // print every record that is now next in row order
+        Pipeline_item *item;
+        while ((item = pending[next % WINDOW]) != NULL && item->record == next) {
+            pending[next % WINDOW] = NULL;
+
+            if (strcmp(item->label.label, prev_label) < 0) {
+                printf("Label \"%s\" in record %d is out of LABEL order. Run without --pipeline to sort the "
+                       "spreadsheet. Aborting.\n", item->label.label, next);
+                free_item(item);
+                goto done;
+            }
+            // the rows are in LABEL order, so a repeated LABEL follows its first row
+            if (first > 0 && strcmp(item->label.label, prev_label) == 0)
+                duplicates_report(item->label.label, next, first);
+            else
+                first = next;
+            strcpy(prev_label, item->label.label);
+
+            if (item->extra_cells > 0)
+                printf("Record %d has %d more cells than column headings. Extra cells ignored.\n",
+                       next, item->extra_cells);
+
+            if (labeldata && labeldata_add(labeldata, &item->label) != 0) {
+                printf("Could not write label data, line %d. Aborting.\n", item->record);
+                free_item(item);
+                goto done;
+            }
+            if (!print_label_idoc_records(fpout, p->plan, &item->label, item->record, idoc)) {
+                printf("Content error in text-delimited spreadsheet, line %d. Aborting.\n", next);
+                free_item(item);
+                goto done;
+            }
+            free_item(item);
+            atomic_store(&p->next_record, ++next);
+        }
+    }
+    status = 0;
+
+done:
+    // records parsed ahead of one that failed are never printed
+    for (int i = 0; i < WINDOW; i++)
+        if (pending[i] != NULL)
+            free_item(pending[i]);
+    free(pending);
+    return status;
+}
+
+int pipeline_run(FILE *fp, char **buffered, int buffered_count, const Sheet_header *header, const Emit_plan *plan, FILE *fpout, Label_data *labeldata, int workers, Ctrl *idoc) {
+    Pipeline p;
+    pthread_t reader;
+    pthread_t *parsers;
+    int started = 0;
+    int status = -1;
+
+    p.fp = fp;
+    p.buffered = buffered;
+    p.buffered_count = buffered_count;
+    p.buffered_next = 0;
+    p.header = header;
+    p.plan = plan;
+    atomic_init(&p.next_record, 1);
+    atomic_init(&p.stop, false);
+
+    if (workers < 1)
+        workers = 1;
+
+    if (queue_init(&p.rows, QUEUE_CAP) != 0)
+        return -1;
+    if (queue_init(&p.parsed, QUEUE_CAP) != 0) {
+        queue_free(&p.rows);
+        return -1;
+    }
+    parsers = (pthread_t *) malloc(workers * sizeof(pthread_t));
+
+    if (parsers != NULL && pthread_create(&reader, NULL, reader_thread, &p) == 0) {
+        while (started < workers && pthread_create(&parsers[started], NULL, parser_thread, &p) == 0)
+            started++;
+        if (started > 0)
+            status = write_records(&p, fpout, labeldata, started, idoc);
+
+        // on success every stage has already finished; otherwise stop them
+        atomic_store(&p.stop, true);
+        pthread_join(reader, NULL);
+        for (int i = 0; i < started; i++)
+            pthread_join(parsers[i], NULL);
+    }
+
+    void *data;
+    while (queue_try_pop(&p.rows, &data))
+        free_item((Pipeline_item *) data);
+    while (queue_try_pop(&p.parsed, &data))
+        free_item((Pipeline_item *) data);
+
+    // buffered rows the reader did not get to
+    while (p.buffered_next < buffered_count) {
+        memory_charge(MEM_ROWS, -(long long) (strlen(buffered[p.buffered_next]) + 1));
+        free(buffered[p.buffered_next++]);
+    }
+
+    free(parsers);
+    queue_free(&p.rows);
+    queue_free(&p.parsed);
+    return status;
+}
@@ -0,0 +1,34 @@
+/**
+    @file pipeline.h
+    Together with pipeline.c, this component converts a spreadsheet that
+    is already sorted by LABEL in a single streaming pass: a reader thread
+    splits rows, parser threads fill label records and the calling thread
+    prints them, connected by bounded lock-free queues.
+*/
+
+#ifndef STOIDOC_PIPELINE_H
+#define STOIDOC_PIPELINE_H
+
+#include <stdio.h>
+
+#include "idoc.h"
+#include "label.h"
+#include "labeldata.h"
+
+/**
+    streams the label rows of a spreadsheet into the IDoc file
+    @param fp points to the input file, positioned after the column headings
+    @param buffered holds rows already read from the input, which are
+    streamed first and freed by the pipeline; NULL if there are none
+    @param buffered_count is the number of buffered rows
+    @param header contains the resolved column headings
+    @param plan is the emission plan of the sheet
+    @param fpout points to the IDoc file, positioned after the control record
+    @param labeldata is the label data output (-L), or NULL
+    @param workers is the number of parser threads
+    @param idoc contains the sequence and control numbers
+    @return 0 if successful, -1 if a row is out of LABEL order or invalid
+*/
+int pipeline_run(FILE *fp, char **buffered, int buffered_count, const Sheet_header *header, const Emit_plan *plan, FILE *fpout, Label_data *labeldata, int workers, Ctrl *idoc);
+
+#endif //STOIDOC_PIPELINE_H
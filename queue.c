@@ -0,0 +1,80 @@
+/**
+ *  queue.c
+ *
+ *  A bounded MPMC ring buffer: every cell carries a sequence number that
+ *  is advanced by one when it is filled and by the capacity when it is
+ *  emptied, so a single compare-and-swap on head or tail claims a cell.
+ */
+#include "queue.h"
+#include <stdlib.h>
+
+int queue_init(Queue *q, size_t capacity) {
+    size_t size = 2;
+
+    while (size < capacity)
+        size *= 2;
+
+    if ((q->cells = (Queue_cell *) malloc(size * sizeof(Queue_cell))) == NULL)
+        return -1;
+
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&q->cells[i].sequence, i);
+
+    q->mask = size - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    return 0;
+}
+
+void queue_free(Queue *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+bool queue_try_push(Queue *q, void *data) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    for (;;) {
+        Queue_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        long diff = (long) seq - (long) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->data = data;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the cell still holds an item from the previous lap
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+}
+
+bool queue_try_pop(Queue *q, void **data) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    for (;;) {
+        Queue_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        long diff = (long) seq - (long) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *data = cell->data;
+                atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // nothing has been pushed into this cell yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
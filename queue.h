@@ -0,0 +1,62 @@
+/**
+    @file queue.h
+    Together with queue.c, this component is a bounded lock-free queue of
+    pointers that connects the stages of the pipelined converter. Any
+    number of threads may push and pop concurrently.
+*/
+
+#ifndef STOIDOC_QUEUE_H
+#define STOIDOC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* size of a cache line, to keep the producer and consumer ends apart    */
+#define CACHE_LINE            64
+
+/** a queue slot; sequence tells producers and consumers whose turn it is */
+typedef struct {
+    atomic_size_t sequence;
+    void *data;
+} Queue_cell;
+
+/** a bounded multi-producer / multi-consumer queue                       */
+typedef struct {
+    Queue_cell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+} Queue;
+
+/**
+    initializes an empty queue
+    @param q is the queue
+    @param capacity is the number of slots, rounded up to a power of two
+    @return 0 if successful, -1 if unsuccessful.
+*/
+int queue_init(Queue *q, size_t capacity);
+
+/**
+    releases the slots of a queue
+    @param q is the queue
+*/
+void queue_free(Queue *q);
+
+/**
+    appends an item unless the queue is full
+    @param q is the queue
+    @param data is the item
+    @return true if the item was appended
+*/
+bool queue_try_push(Queue *q, void *data);
+
+/**
+    removes the oldest item unless the queue is empty
+    @param q is the queue
+    @param data receives the item
+    @return true if an item was removed
+*/
+bool queue_try_pop(Queue *q, void **data);
+
+#endif //STOIDOC_QUEUE_H
@@ -0,0 +1,334 @@
+/**
+ *  reader.c
+ */
+#include "reader.h"
+#include "text.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* end of line new line character                                        */
+#define LF '\n'
+#define CR '\r'
+#define QUOTE '\"'
+
+/* initial size of a row buffer, doubled as needed                       */
+#define ROW_INITIAL_CAP      1024
+
+/* size of the blocks read from the input file                           */
+#define READ_BLOCK          65536
+
+/* the number of bytes inspected to recognise UTF-16 text without a BOM  */
+#define SNIFF_LEN             64
+
+/* the replacement character for unpaired UTF-16 surrogates              */
+#define REPLACEMENT      0xfffd
+
+/* input encodings: bytes are read as they are (ASCII, UTF-8, Windows-1252) */
+#define ENCODING_BYTES       0
+#define ENCODING_UTF16LE     1
+#define ENCODING_UTF16BE     2
+
+/* reader states                                                         */
+#define IN_FIELD            0   // an unquoted cell
+#define IN_QUOTES           1   // a quoted cell
+#define AFTER_QUOTE         2   // a quote inside a quoted cell: closing or doubled
+
+/** the input buffered by the reader, and where the last row ended. UTF-16
+    input is read into raw and transcoded into block as UTF-8.           */
+static struct {
+    FILE *fp;
+    char block[READ_BLOCK];
+    size_t pos;
+    size_t length;
+    int encoding;
+    unsigned char raw[READ_BLOCK];
+    size_t raw_pos;
+    size_t raw_length;
+} input;
+
+/**
+    returns the offset of the first of the characters a, b or c in a buffer
+    @param s is the buffer
+    @param n is the length of the buffer
+    @return the offset, or n if none of the characters occurs
+*/
+static size_t scan(const char *s, size_t n, char a, char b, char c) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // classify 16 bytes at a time into a bitmask of special characters
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                    _mm_cmpeq_epi8(v, vc));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return i + (size_t) __builtin_ctz((unsigned int) mask);
+    }
+#endif
+    for (; i < n; i++)
+        if (s[i] == a || s[i] == b || s[i] == c)
+            return i;
+    return n;
+}
+
+/**
+    reads a UTF-16 code unit
+*/
+static unsigned int unit(const unsigned char *p) {
+    return input.encoding == ENCODING_UTF16LE ? (unsigned int) (p[0] | p[1] << 8) : (unsigned int) (p[0] << 8 | p[1]);
+}
+
+/**
+    transcodes the raw UTF-16 input into the input block as UTF-8, as far
+    as both the raw input and the room in the block allow
+    @param eof is true if no more raw input follows
+    @return the number of bytes placed in the block
+*/
+static size_t transcode(bool eof) {
+    const unsigned char *p = input.raw + input.raw_pos;
+    const unsigned char *end = input.raw + input.raw_length;
+    char *out = input.block;
+    char *out_end = input.block + READ_BLOCK;
+
+    while (end - p >= 2 && out_end - out >= 8) {
+#ifdef __SSE2__
+        // 8 ASCII code units at a time are narrowed to 8 bytes
+        if (end - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) p);
+            if (input.encoding == ENCODING_UTF16BE)
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            __m128i high = _mm_and_si128(v, _mm_set1_epi16((short) 0xff80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff) {
+                _mm_storel_epi64((__m128i *) out, _mm_packus_epi16(v, v));
+                out += 8;
+                p += 16;
+                continue;
+            }
+        }
+#endif
+        unsigned long code = unit(p);
+        size_t units = 1;
+
+        if (code >= 0xd800 && code <= 0xdbff) {
+            // a high surrogate is completed by the next unit, which may not have been read yet
+            if (end - p < 4) {
+                if (!eof)
+                    break;
+                code = REPLACEMENT;
+            } else if (unit(p + 2) >= 0xdc00 && unit(p + 2) <= 0xdfff) {
+                code = 0x10000 + ((code - 0xd800) << 10) + (unit(p + 2) - 0xdc00);
+                units = 2;
+            } else
+                code = REPLACEMENT;
+        } else if (code >= 0xdc00 && code <= 0xdfff)
+            code = REPLACEMENT;
+
+        out += text_utf8_encode(out, code);
+        p += 2 * units;
+    }
+
+    input.raw_pos = (size_t) (p - input.raw);
+    return (size_t) (out - input.block);
+}
+
+/**
+    refills the input block once it has been used up
+    @return true if there is input left
+*/
+static bool fill(void) {
+    if (input.pos < input.length)
+        return true;
+    input.pos = 0;
+    if (input.encoding == ENCODING_BYTES) {
+        input.length = fread(input.block, 1, READ_BLOCK, input.fp);
+        return input.length > 0;
+    }
+
+    // the raw input left over is moved to the front and topped up
+    input.raw_length -= input.raw_pos;
+    memmove(input.raw, input.raw + input.raw_pos, input.raw_length);
+    input.raw_pos = 0;
+    input.raw_length += fread(input.raw + input.raw_length, 1, READ_BLOCK - input.raw_length, input.fp);
+    input.length = transcode(input.raw_length < READ_BLOCK);
+    return input.length > 0;
+}
+
+/**
+    recognises the encoding of a new input file by its byte order mark or,
+    without one, by the zero bytes of UTF-16 text in its first characters,
+    and skips the byte order mark
+*/
+static void detect_encoding(void) {
+    const unsigned char *b = (const unsigned char *) input.block;
+    size_t n = fread(input.block, 1, READ_BLOCK, input.fp);
+    size_t bom = 0;
+    int odd_zeros = 0, even_zeros = 0;
+
+    input.encoding = ENCODING_BYTES;
+    if (n >= 3 && b[0] == 0xef && b[1] == 0xbb && b[2] == 0xbf)
+        bom = 3;
+    else if (n >= 2 && b[0] == 0xff && b[1] == 0xfe) {
+        input.encoding = ENCODING_UTF16LE;
+        bom = 2;
+    } else if (n >= 2 && b[0] == 0xfe && b[1] == 0xff) {
+        input.encoding = ENCODING_UTF16BE;
+        bom = 2;
+    } else {
+        // column headings are ASCII: in UTF-16 every other byte is zero
+        size_t sniff = n < SNIFF_LEN ? n & ~(size_t) 1 : SNIFF_LEN;
+        for (size_t k = 0; k < sniff; k += 2) {
+            even_zeros += b[k] == 0 && b[k + 1] != 0;
+            odd_zeros += b[k] != 0 && b[k + 1] == 0;
+        }
+        if (sniff >= 4 && odd_zeros * 4 >= (int) sniff)
+            input.encoding = ENCODING_UTF16LE;
+        else if (sniff >= 4 && even_zeros * 4 >= (int) sniff)
+            input.encoding = ENCODING_UTF16BE;
+    }
+
+    if (input.encoding == ENCODING_BYTES) {
+        input.pos = bom;
+        input.length = n;
+    } else {
+        // the block is transcoded on the first fill
+        memcpy(input.raw, input.block + bom, n - bom);
+        input.raw_pos = 0;
+        input.raw_length = n - bom;
+        input.pos = 0;
+        input.length = transcode(n < READ_BLOCK);
+    }
+}
+
+/**
+    makes room for n more characters and the terminating null character
+    @return false if the row cannot grow
+*/
+static bool reserve(char **buffer, size_t *cap, size_t i, size_t n) {
+    size_t needed = i + n + 1;
+    if (needed <= *cap)
+        return true;
+
+    size_t grown_cap = *cap;
+    while (grown_cap < needed)
+        grown_cap *= 2;
+    char *grown = (char *) realloc(*buffer, grown_cap);
+    if (grown == NULL)
+        return false;
+    *buffer = grown;
+    *cap = grown_cap;
+    return true;
+}
+
+/**
+    ends a row and gives back the unused part of its buffer, so that a
+    buffered spreadsheet holds only the bytes of its rows
+    @return the row
+*/
+static char *finish_row(char *buffer, size_t i) {
+    buffer[i] = '\0';
+    char *fitted = (char *) realloc(buffer, i + 1);
+    return fitted != NULL ? fitted : buffer;
+}
+
+/**
+    returns true if the row contains anything besides tabs and CRs
+*/
+static bool row_not_empty(const char *buffer, size_t i) {
+    for (size_t k = 0; k < i; k++)
+        if (buffer[k] != '\t' && buffer[k] != CR)
+            return true;
+    return false;
+}
+
+char *read_row(FILE *fp) {
+
+    size_t cap = ROW_INITIAL_CAP;
+    size_t i = 0;
+    int state = IN_FIELD;
+    char *buffer = (char *) malloc(cap);
+
+    if (buffer == NULL)
+        return NULL;
+
+    // a new file starts with its encoding
+    if (input.fp != fp) {
+        input.fp = fp;
+        detect_encoding();
+    }
+
+    while (fill()) {
+        const char *s = input.block + input.pos;
+        size_t n = input.length - input.pos;
+
+        if (state == AFTER_QUOTE) {
+            // a doubled quote stays inside the cell, anything else closes it
+            if (*s == QUOTE) {
+                if (!reserve(&buffer, &cap, i, 1))
+                    break;
+                buffer[i++] = QUOTE;
+                input.pos++;
+                state = IN_QUOTES;
+                continue;
+            }
+            state = IN_FIELD;
+        }
+
+        // copy the run of ordinary characters up to the next special one
+        size_t run = state == IN_FIELD ? scan(s, n, LF, QUOTE, LF) : scan(s, n, LF, QUOTE, '\t');
+        if (!reserve(&buffer, &cap, i, run + 1))
+            break;
+        memcpy(buffer + i, s, run);
+        i += run;
+        input.pos += run;
+        if (run == n)
+            continue;
+
+        char c = s[run];
+        input.pos++;
+
+        if (c == QUOTE) {
+            buffer[i++] = QUOTE;
+            if (state == IN_QUOTES)
+                state = AFTER_QUOTE;
+            else if (i == 1 || buffer[i - 2] == '\t')
+                // only a quote at the start of a cell opens a quoted cell
+                state = IN_QUOTES;
+        } else if (c == '\t') {
+            // a tab inside a quoted cell must not split it
+            buffer[i++] = ' ';
+        } else {
+            // the CR of a CRLF line ending is dropped
+            if (i > 0 && buffer[i - 1] == CR)
+                i--;
+
+            //check if preceded by "##" - in that case the line continues
+            if ((i >= 2) && buffer[i - 1] == '#' && buffer[i - 2] == '#')
+                continue;
+
+            if (state == IN_QUOTES) {
+                // a line break inside a quoted cell is not the end of the row
+                buffer[i++] = ' ';
+            } else if (row_not_empty(buffer, i)) {
+                return finish_row(buffer, i);
+            } else
+                i = 0;
+        }
+    }
+
+    // an unterminated last line is still a row
+    if (i > 0 && buffer[i - 1] == CR)
+        i--;
+    if (row_not_empty(buffer, i))
+        return finish_row(buffer, i);
+    free(buffer);
+    return NULL;
+}
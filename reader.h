@@ -0,0 +1,26 @@
+/**
+    @file reader.h
+    Together with reader.c, this component is responsible for splitting a
+    tab-delimited spreadsheet into rows, following the quoting of
+    Excel's text export.
+*/
+
+#ifndef STOIDOC_READER_H
+#define STOIDOC_READER_H
+
+#include <stdio.h>
+
+/**
+    reads the next spreadsheet row. The LF (or CRLF) at the end of the row
+    is removed. A LF preceded by "##" does not end the row, and rows
+    containing just tab characters are skipped. A cell that starts with a
+    quote runs to its closing quote: tabs inside it become spaces, and line
+    breaks inside it become spaces unless they follow "##". The quotes are
+    kept. The input is read in blocks, so the rows of one file must all be
+    read through read_row.
+    @param fp points to the input file
+    @return a dynamically allocated row, or NULL at the end of the file
+*/
+char *read_row(FILE *fp);
+
+#endif //STOIDOC_READER_H
@@ -0,0 +1,281 @@
+/**
+ *  suggest.c
+ */
+#include "suggest.h"
+#include "lookup.h"
+#include "memory.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the most keys suggested for one value                                 */
+#define SUGGEST_MAX          3
+
+/* the largest edit distance that is ever suggested                      */
+#define DISTANCE_MAX         3
+
+/* the most values whose suggestions are remembered, and the initial
+   number of buckets, a power of two                                     */
+#define MEMO_MAX             4096
+#define MEMO_INITIAL_CAP     64
+
+/* FNV-1a 64-bit parameters                                              */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x00000100000001b3ULL
+
+/** a node of the BK-tree: a key, and its distance from its parent       */
+typedef struct {
+    const char *key;
+    int length;
+    int distance;
+    int farthest;           // the largest distance of a child
+    int first_child;        // -1 if none
+    int next_sibling;       // -1 if none
+} Bk_node;
+
+/** a value asked about before, and its suggestion (NULL if none)        */
+typedef struct {
+    uint64_t hash;
+    char *value;
+    char *suggestion;
+} Memo;
+
+static Bk_node *tree = NULL;
+static int tree_size = 0;
+
+static Memo *memo = NULL;
+static size_t memo_cap = 0;
+static size_t memo_count = 0;
+
+/**
+    returns the case insensitive Levenshtein distance of a value and a key,
+    giving up as soon as it is known to be over a bound
+    @param key is a lookup key, shorter than LRG
+    @param bound is the largest distance of interest
+    @return the distance, or bound + 1 if it is larger than bound
+*/
+static int distance(const char *value, int value_length, const char *key, int key_length, int bound) {
+    int row[LRG + 1];
+
+    // the difference in length is a lower bound
+    if (abs(value_length - key_length) > bound)
+        return bound + 1;
+
+    for (int j = 0; j <= key_length; j++)
+        row[j] = j;
+
+    for (int i = 1; *value; value++, i++) {
+        int diagonal = row[0];
+        int smallest = row[0] = i;
+        for (int j = 1; j <= key_length; j++) {
+            int above = row[j];
+            int cost = tolower((unsigned char) *value) != tolower((unsigned char) key[j - 1]);
+            int best = diagonal + cost;
+            if (above + 1 < best)
+                best = above + 1;
+            if (row[j - 1] + 1 < best)
+                best = row[j - 1] + 1;
+            row[j] = best;
+            diagonal = above;
+            if (best < smallest)
+                smallest = best;
+        }
+        // the distance is at least the smallest entry of any row
+        if (smallest > bound)
+            return bound + 1;
+    }
+    return row[key_length] <= bound ? row[key_length] : bound + 1;
+}
+
+/**
+    builds the BK-tree over the lookup keys. Keys that differ only in case
+    are kept once.
+    @return 0 if successful, -1 otherwise
+*/
+static int build_tree(void) {
+    if ((tree = (Bk_node *) malloc(lookupsize * sizeof(Bk_node))) == NULL)
+        return -1;
+    memory_charge(MEM_LOOKUP, (long long) (lookupsize * sizeof(Bk_node)));
+
+    for (int i = 0; i < lookupsize; i++) {
+        const char *key = lookup[i][0];
+        int length = (int) strlen(key);
+        int node = 0;
+
+        if (tree_size == 0) {
+            tree[tree_size++] = (Bk_node) {key, length, 0, 0, -1, -1};
+            continue;
+        }
+        for (;;) {
+            int d = distance(key, length, tree[node].key, tree[node].length, 2 * LRG);
+            if (d == 0)
+                break;
+
+            int child = tree[node].first_child;
+            while (child != -1 && tree[child].distance != d)
+                child = tree[child].next_sibling;
+            if (child != -1) {
+                node = child;
+                continue;
+            }
+
+            tree[tree_size] = (Bk_node) {key, length, d, 0, -1, tree[node].first_child};
+            tree[node].first_child = tree_size++;
+            if (d > tree[node].farthest)
+                tree[node].farthest = d;
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+    finds the keys closest to a value, within a limit
+    @param found receives up to SUGGEST_MAX keys, all at the closest distance
+    @return the number of keys found
+*/
+static int search(const char *value, int limit, const char *found[]) {
+    int *stack = (int *) malloc(tree_size * sizeof(int));
+    int length = (int) strlen(value);
+    int top = 0;
+    int count = 0;
+
+    if (stack == NULL)
+        return 0;
+
+    stack[top++] = 0;
+    while (top > 0) {
+        int node = stack[--top];
+        // past this bound neither the node nor any of its children can be close enough
+        int bound = tree[node].farthest + limit;
+        int d = distance(value, length, tree[node].key, tree[node].length, bound);
+
+        // a closer key replaces the ones found so far, and narrows the search
+        if (d < limit || (d == limit && count == 0)) {
+            limit = d;
+            count = 0;
+        }
+        if (d == limit && count < SUGGEST_MAX)
+            found[count++] = tree[node].key;
+
+        // by the triangle inequality, only children this far from the node can be close enough
+        for (int child = tree[node].first_child; child != -1; child = tree[child].next_sibling)
+            if (tree[child].distance >= d - limit && tree[child].distance <= d + limit)
+                stack[top++] = child;
+    }
+    free(stack);
+    return count;
+}
+
+static uint64_t hash_value(const char *value) {
+    uint64_t hash = FNV_OFFSET;
+    for (; *value; value++) {
+        hash ^= (unsigned char) *value;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+    finds the bucket of a value: the bucket holding it, or the empty
+    bucket it would go into
+*/
+static Memo *find_memo(uint64_t hash, const char *value) {
+    size_t mask = memo_cap - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+        if (memo[i].value == NULL || (memo[i].hash == hash && strcmp(memo[i].value, value) == 0))
+            return &memo[i];
+}
+
+/**
+    doubles the number of buckets, keeping the load factor at most one half
+    @return 0 if successful, -1 otherwise
+*/
+static int grow_memo(void) {
+    size_t cap = memo_cap ? 2 * memo_cap : MEMO_INITIAL_CAP;
+    Memo *old = memo;
+    size_t old_cap = memo_cap;
+
+    if ((memo = (Memo *) calloc(cap, sizeof(Memo))) == NULL) {
+        memo = old;
+        return -1;
+    }
+    memo_cap = cap;
+    memory_charge(MEM_LOOKUP, (long long) ((cap - old_cap) * sizeof(Memo)));
+
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i].value != NULL)
+            *find_memo(old[i].hash, old[i].value) = old[i];
+    free(old);
+    return 0;
+}
+
+const char *suggest_lookup(const char *value, bool *first) {
+    static char suggestion[SUGGEST_MAX * (LRG + 8)];
+    uint64_t hash = hash_value(value);
+
+    *first = true;
+    if (tree == NULL && build_tree() != 0)
+        return NULL;
+
+    if (memo_count > 0) {
+        Memo *bucket = find_memo(hash, value);
+        if (bucket->value != NULL) {
+            *first = false;
+            return bucket->suggestion;
+        }
+    }
+
+    // one edit in four characters, so that short values are not matched to anything
+    size_t length = strlen(value);
+    int limit = length / 4 + (length % 4 >= 2);
+    if (limit > DISTANCE_MAX)
+        limit = DISTANCE_MAX;
+
+    const char *found[SUGGEST_MAX];
+    int count = limit > 0 ? search(value, limit, found) : 0;
+    size_t used = 0;
+
+    for (int i = 0; i < count; i++)
+        used += snprintf(suggestion + used, sizeof(suggestion) - used, "%s\"%s\"", i > 0 ? " or " : "", found[i]);
+
+    // values past MEMO_MAX are searched every time
+    if (memo_count < MEMO_MAX && (2 * (memo_count + 1) <= memo_cap || grow_memo() == 0)) {
+        Memo *bucket = find_memo(hash, value);
+        bucket->value = strdup(value);
+        bucket->suggestion = count > 0 ? strdup(suggestion) : NULL;
+        if (bucket->value != NULL) {
+            bucket->hash = hash;
+            memo_count++;
+            memory_charge(MEM_LOOKUP, (long long) (length + 1 + (count > 0 ? used + 1 : 0)));
+            return bucket->suggestion;
+        }
+        free(bucket->suggestion);
+        bucket->suggestion = NULL;
+    }
+    return count > 0 ? suggestion : NULL;
+}
+
+void suggest_release(void) {
+    for (size_t i = 0; i < memo_cap; i++) {
+        if (memo[i].value != NULL)
+            memory_charge(MEM_LOOKUP, -(long long) (strlen(memo[i].value) + 1 +
+                                                     (memo[i].suggestion ? strlen(memo[i].suggestion) + 1 : 0)));
+        free(memo[i].value);
+        free(memo[i].suggestion);
+    }
+    free(memo);
+    memory_charge(MEM_LOOKUP, -(long long) (memo_cap * sizeof(Memo)));
+    memo = NULL;
+    memo_cap = 0;
+    memo_count = 0;
+
+    if (tree != NULL)
+        memory_charge(MEM_LOOKUP, -(long long) (lookupsize * sizeof(Bk_node)));
+    free(tree);
+    tree = NULL;
+    tree_size = 0;
+}
@@ -0,0 +1,31 @@
+/**
+    @file suggest.h
+    Together with suggest.c, this component is responsible for the "did
+    you mean" hints given when a LEVEL or graphic value is not in the SAP
+    lookup table: the closest lookup keys are found through a BK-tree
+    over the keys, and the answer for each value is remembered.
+*/
+
+#ifndef STOIDOC_SUGGEST_H
+#define STOIDOC_SUGGEST_H
+
+#include <stdbool.h>
+
+/**
+    finds the lookup keys closest to a value that is not in the lookup
+    table, by case insensitive edit distance. Only keys within a distance
+    that grows with the length of the value are suggested, so free text is
+    rarely matched. Not thread safe; it is only called while the records
+    are printed for the first time, which is on one thread.
+    @param value is the value that was not found
+    @param first receives whether the value is asked about for the first time
+    @return the closest keys, quoted and joined by "or", or NULL if no key is close
+*/
+const char *suggest_lookup(const char *value, bool *first);
+
+/**
+    frees the BK-tree and the remembered suggestions
+*/
+void suggest_release(void);
+
+#endif //STOIDOC_SUGGEST_H
@@ -0,0 +1,160 @@
+/**
+ *  tails.c
+ */
+#include "tails.h"
+#include "memory.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the initial number of buckets, a power of two                         */
+#define TAILS_INITIAL_CAP     256
+
+/* FNV-1a 64-bit parameters                                              */
+#define FNV_OFFSET   0xcbf29ce484222325ULL
+#define FNV_PRIME    0x00000100000001b3ULL
+
+/** a remembered tail and its key; the key strings are kept in text      */
+typedef struct {
+    uint64_t hash;
+    int kind;
+    int cell;
+    size_t name_length;
+    size_t value_length;
+    size_t length;
+    char *text;             // name, value and tail, each NUL terminated
+} Tail;
+
+/* the open addressing table of the tails remembered so far              */
+static Tail *tails = NULL;
+static size_t tails_cap = 0;
+static size_t tails_count = 0;
+static size_t tails_bytes = 0;
+
+static uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+    hashes the key of a tail
+*/
+static uint64_t hash_key(int kind, int cell, const char *name, size_t name_length,
+                         const char *value, size_t value_length) {
+    uint64_t hash = hash_bytes(FNV_OFFSET, name, name_length + 1);
+    hash = hash_bytes(hash, value, value_length);
+    hash ^= (uint64_t) (kind << 8 | cell);
+    return hash * FNV_PRIME;
+}
+
+/**
+    finds the bucket of a key: the bucket holding it, or the empty bucket
+    it would go into
+*/
+static Tail *find_bucket(uint64_t hash, int kind, int cell, const char *name, size_t name_length,
+                         const char *value, size_t value_length) {
+    size_t mask = tails_cap - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Tail *tail = &tails[i];
+        if (tail->text == NULL)
+            return tail;
+        if (tail->hash == hash && tail->kind == kind && tail->cell == cell &&
+            tail->name_length == name_length && tail->value_length == value_length &&
+            memcmp(tail->text, name, name_length) == 0 &&
+            memcmp(tail->text + name_length + 1, value, value_length) == 0)
+            return tail;
+    }
+}
+
+/**
+    doubles the number of buckets, keeping the load factor at most one half
+    @return 0 if successful, -1 otherwise
+*/
+static int grow(void) {
+    size_t cap = tails_cap ? 2 * tails_cap : TAILS_INITIAL_CAP;
+    Tail *old = tails;
+    size_t old_cap = tails_cap;
+
+    if (!memory_fits((long long) ((cap - old_cap) * sizeof(Tail))))
+        return -1;
+    if ((tails = (Tail *) calloc(cap, sizeof(Tail))) == NULL) {
+        tails = old;
+        return -1;
+    }
+    tails_cap = cap;
+    memory_charge(MEM_LOOKUP, (long long) ((cap - old_cap) * sizeof(Tail)));
+
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].text != NULL) {
+            size_t j = old[i].hash & (cap - 1);
+            while (tails[j].text != NULL)
+                j = (j + 1) & (cap - 1);
+            tails[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+const char *tails_find(int kind, int cell, const char *name, const char *value, size_t *length) {
+    if (tails_count == 0)
+        return NULL;
+
+    size_t name_length = strlen(name);
+    size_t value_length = strlen(value);
+    uint64_t hash = hash_key(kind, cell, name, name_length, value, value_length);
+    Tail *tail = find_bucket(hash, kind, cell, name, name_length, value, value_length);
+
+    if (tail->text == NULL)
+        return NULL;
+    *length = tail->length;
+    return tail->text + name_length + value_length + 2;
+}
+
+const char *tails_store(int kind, int cell, const char *name, const char *value, const char *tail, size_t length) {
+    if (tails_count >= TAILS_MAX_COUNT || length > TAIL_MAX)
+        return NULL;
+    if (2 * (tails_count + 1) > tails_cap && grow() != 0)
+        return NULL;
+
+    size_t name_length = strlen(name);
+    size_t value_length = strlen(value);
+    uint64_t hash = hash_key(kind, cell, name, name_length, value, value_length);
+    Tail *bucket = find_bucket(hash, kind, cell, name, name_length, value, value_length);
+
+    if (bucket->text == NULL) {
+        // over the --max-memory budget the tail is rendered every time instead
+        size_t size = name_length + value_length + length + 3;
+        if (!memory_fits((long long) size))
+            return NULL;
+        char *text = (char *) malloc(size);
+        if (text == NULL)
+            return NULL;
+        memory_charge(MEM_LOOKUP, (long long) size);
+        tails_bytes += size;
+
+        memcpy(text, name, name_length + 1);
+        memcpy(text + name_length + 1, value, value_length + 1);
+        memcpy(text + name_length + value_length + 2, tail, length);
+        text[name_length + value_length + 2 + length] = '\0';
+
+        *bucket = (Tail) {hash, kind, cell, name_length, value_length, length, text};
+        tails_count++;
+    }
+    return bucket->text + name_length + value_length + 2;
+}
+
+void tails_release(void) {
+    for (size_t i = 0; i < tails_cap; i++)
+        free(tails[i].text);
+    free(tails);
+    memory_charge(MEM_LOOKUP, -(long long) (tails_bytes + tails_cap * sizeof(Tail)));
+    tails = NULL;
+    tails_bytes = 0;
+    tails_cap = 0;
+    tails_count = 0;
+}
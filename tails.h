@@ -0,0 +1,49 @@
+/**
+    @file tails.h
+    Together with tails.c, this component is responsible for remembering
+    the rendered tails of characteristic (Z2BTLC) records: the column name,
+    the value and the graphic path or value that follow the record prefix.
+    The same column and value pairs repeat throughout a sheet, so each tail
+    is padded and formatted once per run.
+*/
+
+#ifndef STOIDOC_TAILS_H
+#define STOIDOC_TAILS_H
+
+#include <stddef.h>
+
+/* the longest tail that is remembered                                   */
+#define TAIL_MAX             1024
+
+/* the most tails remembered in a run                                    */
+#define TAILS_MAX_COUNT     65536
+
+/**
+    looks up a rendered tail
+    @param kind tells apart the ways a record can be rendered
+    @param cell is the cell class of the value
+    @param name is the column name
+    @param value is the cell value
+    @param length receives the length of the tail
+    @return the tail, or NULL if it has not been remembered
+*/
+const char *tails_find(int kind, int cell, const char *name, const char *value, size_t *length);
+
+/**
+    remembers a rendered tail
+    @param kind tells apart the ways a record can be rendered
+    @param cell is the cell class of the value
+    @param name is the column name
+    @param value is the cell value
+    @param tail is the rendered tail
+    @param length is the length of the tail
+    @return the remembered copy of the tail, or NULL if it was not remembered
+*/
+const char *tails_store(int kind, int cell, const char *name, const char *value, const char *tail, size_t length);
+
+/**
+    forgets every remembered tail
+*/
+void tails_release(void);
+
+#endif //STOIDOC_TAILS_H
@@ -0,0 +1,22 @@
+# converts labeldata_quoted.txt with -L and compares the label data CSV
+# with labeldata_quoted.csv: quoted SIZE, DESCRIPTION and TDLINE cells are
+# exported unquoted, and TDLINE lines are split at "##"
+#
+#   cmake -DSTOIDOC=<program> -DSOURCE=<tests folder> -DWORK=<folder> [-DOPTIONS=...] -P labeldata_quoted.cmake
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK})
+configure_file(${SOURCE}/labeldata_quoted.txt ${WORK}/labeldata_quoted.txt COPYONLY)
+
+execute_process(COMMAND ${STOIDOC} labeldata_quoted.txt -n -L ${OPTIONS}
+                WORKING_DIRECTORY ${WORK}
+                RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "stoidoc4 exited with ${result}")
+endif ()
+
+file(READ ${SOURCE}/labeldata_quoted.csv expected)
+file(READ ${WORK}/labeldata_quoted_labeldata.csv actual)
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "labeldata_quoted_labeldata.csv differs from labeldata_quoted.csv:\n${actual}")
+endif ()
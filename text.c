@@ -0,0 +1,155 @@
+/**
+ *  text.c
+ */
+#include "text.h"
+#include <string.h>
+
+/* the TDLINE line separator                                             */
+#define LINE_BREAK          '#'
+
+void text_unquote_bounds(const char *text, const char **start, const char **end) {
+    const char *last = text + strlen(text);
+
+    //check for and skip any leading...
+    if (*text == '\"')
+        text++;
+
+    // ...and/or trailing quotes
+    if (last > text && last[-1] == '\"')
+        last--;
+
+    *start = text;
+    *end = last;
+}
+
+bool text_next_line(const char **cursor, const char *end, Text_slice *line) {
+    const char *c = *cursor;
+
+    if (c >= end)
+        return false;
+
+    line->start = c;
+    line->length = 0;
+    line->line_break = false;
+
+    while (c < end) {
+        if (c[0] == LINE_BREAK && c + 1 < end && c[1] == LINE_BREAK) {
+            line->line_break = true;
+            break;
+        }
+        if (*c == '\"')
+            while (c + 1 < end && c[1] == '\"')
+                c++;
+        // a multibyte character takes a single column
+        size_t sequence = text_utf8_sequence(c, (size_t) (end - c));
+        line->length++;
+        c += sequence ? sequence : 1;
+    }
+
+    line->end = c;
+    *cursor = line->line_break ? c + 2 : c;
+    return true;
+}
+
+void text_print(FILE *fpout, const Text_slice *line) {
+    const char *c = line->start;
+
+    while (c < line->end) {
+        const char *quote = (const char *) memchr(c, '\"', (size_t) (line->end - c));
+        const char *stop = quote ? quote + 1 : line->end;
+
+        fwrite(c, 1, (size_t) (stop - c), fpout);
+        c = stop;
+        while (c < line->end && *c == '\"')
+            c++;
+    }
+}
+
+size_t text_unquote(char *dest, size_t size, const char *text, bool collapse) {
+    const char *c, *end;
+    size_t i = 0;
+
+    text_unquote_bounds(text, &c, &end);
+    while (c < end && i + 1 < size) {
+        size_t sequence = text_utf8_sequence(c, (size_t) (end - c));
+        if (sequence > 0) {
+            // a character that does not fit is left out whole
+            if (i + sequence + 1 > size)
+                break;
+            memcpy(dest + i, c, sequence);
+            i += sequence;
+            c += sequence;
+            continue;
+        }
+        dest[i++] = *c;
+        if (collapse && *c == '\"')
+            while (c + 1 < end && c[1] == '\"')
+                c++;
+        c++;
+    }
+    dest[i] = '\0';
+    return i;
+}
+
+size_t text_utf8_encode(char *dest, unsigned long code) {
+    if (code < 0x80) {
+        dest[0] = (char) code;
+        return 1;
+    } else if (code < 0x800) {
+        dest[0] = (char) (0xc0 | code >> 6);
+        dest[1] = (char) (0x80 | (code & 0x3f));
+        return 2;
+    } else if (code < 0x10000) {
+        dest[0] = (char) (0xe0 | code >> 12);
+        dest[1] = (char) (0x80 | (code >> 6 & 0x3f));
+        dest[2] = (char) (0x80 | (code & 0x3f));
+        return 3;
+    }
+    dest[0] = (char) (0xf0 | code >> 18);
+    dest[1] = (char) (0x80 | (code >> 12 & 0x3f));
+    dest[2] = (char) (0x80 | (code >> 6 & 0x3f));
+    dest[3] = (char) (0x80 | (code & 0x3f));
+    return 4;
+}
+
+size_t text_utf8_sequence(const char *s, size_t length) {
+    const unsigned char *u = (const unsigned char *) s;
+    size_t sequence;
+
+    // C0, C1 and F5-FF never start a sequence, so single byte text is rarely mistaken for one
+    if (length == 0 || u[0] < 0xc2 || u[0] > 0xf4)
+        return 0;
+    sequence = u[0] < 0xe0 ? 2 : u[0] < 0xf0 ? 3 : 4;
+    if (sequence > length)
+        return 0;
+    for (size_t k = 1; k < sequence; k++)
+        if ((u[k] & 0xc0) != 0x80)
+            return 0;
+    return sequence;
+}
+
+size_t text_utf8_cut(const char *s, size_t length, size_t cut) {
+    // a sequence is at most 4 bytes long, so its start is at most 3 bytes back
+    for (size_t back = 1; back <= 3 && back <= cut; back++) {
+        size_t sequence = text_utf8_sequence(s + cut - back, length - (cut - back));
+        if (sequence > back)
+            return cut - back;
+        if (sequence > 0)
+            break;
+    }
+    return cut;
+}
+
+int text_utf8_extra(const char *s) {
+    size_t length = strlen(s);
+    int extra = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        size_t sequence = text_utf8_sequence(s + i, length - i);
+        if (sequence > 0) {
+            extra += (int) sequence - 1;
+            i += sequence - 1;
+        }
+    }
+    return extra;
+}
@@ -0,0 +1,94 @@
+/**
+    @file text.h
+    Together with text.c, this component is responsible for reading quoted
+    cell text without modifying it: Excel's text export wraps a cell in
+    quotes and doubles the quotes inside it, and TDLINE text is split into
+    lines at every "##". Text is handled as bytes; valid UTF-8 sequences
+    are counted as one character and never cut in two.
+*/
+
+#ifndef STOIDOC_TEXT_H
+#define STOIDOC_TEXT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/** a TDLINE line: a range of the cell text and its printed length       */
+typedef struct {
+    const char *start;
+    const char *end;
+    int length;
+    bool line_break;
+} Text_slice;
+
+/**
+    finds the cell text without one leading and one trailing quote
+    @param text is the cell text
+    @param start receives the start of the unquoted text
+    @param end receives the end of the unquoted text
+*/
+void text_unquote_bounds(const char *text, const char **start, const char **end);
+
+/**
+    returns the next line of unquoted TDLINE text. Every call scans only
+    the returned line, so splitting a whole text is linear in its length.
+    @param cursor is the start of the remaining text, advanced past the line
+    @param end is the end of the unquoted text
+    @param line receives the line; its length counts each run of quotes once
+    @return true if a line was found, false at the end of the text
+*/
+bool text_next_line(const char **cursor, const char *end, Text_slice *line);
+
+/**
+    prints a line, collapsing every run of quotes into a single quote
+    @param fpout points to the output file
+    @param line is the line to print
+*/
+void text_print(FILE *fpout, const Text_slice *line);
+
+/**
+    copies the cell text without its surrounding quotes
+    @param dest receives the unquoted text
+    @param size is the size of dest
+    @param text is the cell text
+    @param collapse is true to also collapse runs of quotes into one quote
+    @return the length of the unquoted text
+*/
+size_t text_unquote(char *dest, size_t size, const char *text, bool collapse);
+
+/**
+    encodes a code point as UTF-8
+    @param dest receives the encoded bytes, at most 4
+    @param code is the code point
+    @return the number of bytes written
+*/
+size_t text_utf8_encode(char *dest, unsigned long code);
+
+/**
+    finds the length of the UTF-8 sequence at the start of a text
+    @param s is the text
+    @param length is the number of bytes available at s
+    @return the length of a valid multibyte sequence, or 0 if s does not
+            start one (an ASCII or a single byte encoded character)
+*/
+size_t text_utf8_sequence(const char *s, size_t length);
+
+/**
+    moves a truncation point back to the start of the UTF-8 sequence it
+    would split
+    @param s is the text
+    @param length is the length of the text
+    @param cut is the number of bytes to keep
+    @return the number of bytes to keep, at most cut
+*/
+size_t text_utf8_cut(const char *s, size_t length, size_t cut);
+
+/**
+    counts the bytes a text takes beyond one per character, so that a
+    field padded to a width in bytes can be padded to it in characters
+    @param s is the text
+    @return the number of continuation bytes of its UTF-8 sequences
+*/
+int text_utf8_extra(const char *s);
+
+#endif //STOIDOC_TEXT_H
@@ -0,0 +1,395 @@
+/**
+ *  uring.c
+ */
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/* number of output blocks, and so of writes in flight at most           */
+#define BLOCKS                 2
+
+/* size of the stdio buffer in front of the blocks                       */
+#define STREAM_BUFFER  (64 * 1024)
+
+/** an output block and the write of it that may be in flight            */
+typedef struct {
+    char *data;
+    size_t length;
+    off_t offset;
+    bool in_flight;
+    struct iovec iov;
+} Block;
+
+#ifdef HAVE_IO_URING
+/** the submission and completion rings shared with the kernel           */
+typedef struct {
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+} Ring;
+#endif
+
+/** the state of an asynchronous output stream                           */
+typedef struct {
+    int fd;
+    bool sync;
+    bool uring;
+    int status;
+    off_t offset;
+    int current;
+    Block blocks[BLOCKS];
+#ifdef HAVE_IO_URING
+    Ring ring;
+#endif
+} Uring_stream;
+
+/* whether the last stream opened uses io_uring                          */
+static bool last_uring = false;
+
+/**
+    writes a whole buffer at an offset, retrying short writes
+    @return 0 if successful, -1 otherwise
+*/
+static int write_all(int fd, const char *data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        length -= (size_t) written;
+        offset += written;
+    }
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+
+static int ring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+/**
+    creates the rings and maps them
+    @return 0 if successful, -1 if io_uring is not available
+*/
+static int ring_open(Ring *ring) {
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    if ((ring->fd = ring_setup(BLOCKS + 1, &params)) < 0)
+        return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // newer kernels map both rings at once
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqes_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    char *sq = (char *) ring->sq_ring;
+    char *cq = (char *) ring->cq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void ring_close(Ring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/**
+    queues one operation and submits it
+    @param ring is the ring
+    @param opcode is IORING_OP_WRITEV or IORING_OP_FSYNC
+    @param fd is the file written
+    @param iov is the data written, or NULL
+    @param offset is the file offset written at
+    @param user_data identifies the operation on completion
+    @return 0 if successful, -1 otherwise
+*/
+static int ring_submit(Ring *ring, int opcode, int fd, struct iovec *iov, off_t offset, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t) opcode;
+    sqe->fd = fd;
+    sqe->off = (uint64_t) offset;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = iov ? 1 : 0;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+
+    // the entry must be visible to the kernel before the new tail
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int submitted;
+    while ((submitted = ring_enter(ring->fd, 1, 0, 0)) < 0 && errno == EINTR);
+    if (submitted == 1)
+        return 0;
+
+    // the kernel only takes entries while entering, so one it did not take is withdrawn
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    return -1;
+}
+
+/**
+    waits for one completion
+    @param ring is the ring
+    @param user_data receives the operation that completed
+    @param result receives its result: bytes written, or a negative errno
+    @return 0 if successful, -1 otherwise
+*/
+static int ring_wait(Ring *ring, uint64_t *user_data, int *result) {
+    unsigned head = *ring->cq_head;
+
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        if (ring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+    waits until a block is no longer being written; a short write is
+    finished with pwrite. If the completions can not be read, the stream
+    has failed and the ring is closed, so that no write in flight outlives
+    the blocks it reads from.
+*/
+static void finish_block(Uring_stream *us, Block *block) {
+    while (block->in_flight) {
+        uint64_t user_data;
+        int result;
+
+        if (ring_wait(&us->ring, &user_data, &result) != 0) {
+            us->status = -1;
+            ring_close(&us->ring);
+            us->uring = false;
+            for (int b = 0; b < BLOCKS; b++)
+                us->blocks[b].in_flight = false;
+            return;
+        }
+
+        Block *done = &us->blocks[user_data];
+        done->in_flight = false;
+        if (result < 0)
+            us->status = -1;
+        else if ((size_t) result < done->length &&
+                 write_all(us->fd, done->data + result, done->length - result, done->offset + result) != 0)
+            us->status = -1;
+        done->length = 0;
+    }
+}
+
+#endif
+
+/**
+    hands the current block to the kernel and switches to the other one,
+    waiting only if the other block is still being written
+*/
+static void flush_block(Uring_stream *us) {
+    Block *block = &us->blocks[us->current];
+
+    if (block->length == 0)
+        return;
+    block->offset = us->offset;
+    us->offset += (off_t) block->length;
+
+#ifdef HAVE_IO_URING
+    if (us->uring) {
+        block->iov.iov_base = block->data;
+        block->iov.iov_len = block->length;
+        block->in_flight = true;
+        if (ring_submit(&us->ring, IORING_OP_WRITEV, us->fd, &block->iov, block->offset,
+                        (uint64_t) us->current) != 0) {
+            block->in_flight = false;
+            if (write_all(us->fd, block->data, block->length, block->offset) != 0)
+                us->status = -1;
+            block->length = 0;
+        }
+        us->current = (us->current + 1) % BLOCKS;
+        finish_block(us, &us->blocks[us->current]);
+        return;
+    }
+#endif
+
+    if (write_all(us->fd, block->data, block->length, block->offset) != 0)
+        us->status = -1;
+    block->length = 0;
+}
+
+/**
+    the write function of the stream: gathers the printed records into
+    the current block
+*/
+static ssize_t uring_write(void *cookie, const char *buf, size_t size) {
+    Uring_stream *us = (Uring_stream *) cookie;
+    size_t left = size;
+
+    while (left > 0) {
+        Block *block = &us->blocks[us->current];
+        size_t room = URING_BLOCK_SIZE - block->length;
+        size_t n = left < room ? left : room;
+
+        memcpy(block->data + block->length, buf, n);
+        block->length += n;
+        buf += n;
+        left -= n;
+        if (block->length == URING_BLOCK_SIZE)
+            flush_block(us);
+    }
+    return us->status == 0 ? (ssize_t) size : -1;
+}
+
+/**
+    the close function of the stream: writes the last block, waits for
+    the writes in flight, flushes the file to disk if asked to and closes it
+*/
+static int uring_close(void *cookie) {
+    Uring_stream *us = (Uring_stream *) cookie;
+
+    flush_block(us);
+
+#ifdef HAVE_IO_URING
+    // a ring whose completions could not be read is closed by finish_block
+    for (int b = 0; us->uring && b < BLOCKS; b++)
+        finish_block(us, &us->blocks[b]);
+
+    if (us->uring) {
+        if (us->sync && us->status == 0) {
+            uint64_t user_data;
+            int result;
+            if (ring_submit(&us->ring, IORING_OP_FSYNC, us->fd, NULL, 0, BLOCKS) != 0 ||
+                ring_wait(&us->ring, &user_data, &result) != 0 || result < 0)
+                us->status = -1;
+        }
+        ring_close(&us->ring);
+    } else
+#endif
+    if (us->sync && us->status == 0 && fsync(us->fd) != 0)
+        us->status = -1;
+
+    if (close(us->fd) != 0)
+        us->status = -1;
+
+    int status = us->status;
+    for (int b = 0; b < BLOCKS; b++)
+        free(us->blocks[b].data);
+    free(us);
+    return status;
+}
+
+FILE *uring_open_output(const char *path, bool sync) {
+    Uring_stream *us = (Uring_stream *) calloc(1, sizeof(Uring_stream));
+    FILE *fp;
+
+    if (us == NULL)
+        return NULL;
+    us->sync = sync;
+    for (int b = 0; b < BLOCKS; b++)
+        if ((us->blocks[b].data = (char *) malloc(URING_BLOCK_SIZE)) == NULL) {
+            for (int f = 0; f < b; f++)
+                free(us->blocks[f].data);
+            free(us);
+            return NULL;
+        }
+
+    if ((us->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+        for (int b = 0; b < BLOCKS; b++)
+            free(us->blocks[b].data);
+        free(us);
+        return NULL;
+    }
+
+#ifdef HAVE_IO_URING
+    us->uring = ring_open(&us->ring) == 0;
+#endif
+    last_uring = us->uring;
+
+    fp = fopencookie(us, "w", (cookie_io_functions_t) {NULL, uring_write, NULL, uring_close});
+    if (fp == NULL) {
+        uring_close(us);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, STREAM_BUFFER);
+    return fp;
+}
+
+bool uring_active(void) {
+    return last_uring;
+}
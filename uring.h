@@ -0,0 +1,36 @@
+/**
+    @file uring.h
+    Together with uring.c, this component is responsible for writing the
+    IDoc file asynchronously. Printed records are gathered into large
+    blocks; a full block is handed to the kernel through io_uring while
+    printing carries on into the other block. Where io_uring is not
+    available the blocks are written with plain write() calls.
+*/
+
+#ifndef STOIDOC_URING_H
+#define STOIDOC_URING_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* size of each of the two output blocks                                 */
+#define URING_BLOCK_SIZE    (1024 * 1024)
+
+/**
+    opens path for writing through the asynchronous writer. Closing the
+    returned stream waits for the outstanding writes, optionally flushes
+    the file to disk and closes it; fclose reports any write error.
+    @param path is the output file
+    @param sync is true to fsync the file when the stream is closed
+    @return a stream to print records to, or NULL on error
+*/
+FILE *uring_open_output(const char *path, bool sync);
+
+/**
+    reports whether the last stream opened uses io_uring or fell back to
+    write() calls
+    @return true if io_uring is used
+*/
+bool uring_active(void);
+
+#endif //STOIDOC_URING_H
@@ -0,0 +1,347 @@
+/**
+ *  watch.c
+ */
+#include "watch.h"
+#include <stdio.h>
+
+#ifdef HAVE_INOTIFY
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* suffixes of the folders next to the watched one                       */
+#define OUT_SUFFIX       "-idoc"
+#define FAILED_SUFFIX    "-failed"
+
+/* the size of the inotify event buffer                                  */
+#define EVENTS_SIZE      4096
+
+/** a dropped spreadsheet, waiting for or being converted by a worker   */
+typedef struct {
+    char *name;
+    pid_t pid;
+    double found;           // when the file was found, in seconds
+} Job;
+
+/* the folders, and the jobs waiting for a worker and being converted    */
+static char watched[PATH_MAX];
+static char out_dir[PATH_MAX];
+static char failed_dir[PATH_MAX];
+static Job *pending = NULL;
+static int pending_count = 0;
+static int pending_cap = 0;
+static Job *running = NULL;
+static int running_count = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+    queues a file for conversion, unless it is queued already. A name is
+    refused if its work folder, log or failure folder could not be named.
+*/
+static void enqueue(const char *name) {
+    size_t length = strlen(name);
+
+    // "<out>/.<name>/<name>" and "<failed>/<name>.<pid>" are the longest paths, and ".<name>"
+    // and "<name>.log" must be file names
+    if (length + sizeof(".log") - 1 > NAME_MAX || strlen(out_dir) + 2 * length + 3 >= PATH_MAX ||
+        strlen(failed_dir) + length + 13 >= PATH_MAX) {
+        printf("Skipping \"%s\": its name is too long.\n", name);
+        return;
+    }
+    for (int i = 0; i < pending_count; i++)
+        if (strcmp(pending[i].name, name) == 0)
+            return;
+
+    if (pending_count == pending_cap) {
+        int cap = pending_cap ? 2 * pending_cap : 16;
+        Job *grown = (Job *) realloc(pending, cap * sizeof(Job));
+        if (grown == NULL)
+            return;
+        pending = grown;
+        pending_cap = cap;
+    }
+    char *copy = strdup(name);
+    if (copy != NULL)
+        pending[pending_count++] = (Job) {copy, 0, now()};
+}
+
+/**
+    queues the regular, not hidden, files of the watched folder
+*/
+static void scan_folder(void) {
+    DIR *dir = opendir(watched);
+    struct dirent *entry;
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (dir == NULL)
+        return;
+    while ((entry = readdir(dir)) != NULL) {
+        if (snprintf(path, sizeof(path), "%s/%s", watched, entry->d_name) >= (int) sizeof(path))
+            continue;
+        if (entry->d_name[0] != '.' && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            enqueue(entry->d_name);
+    }
+    closedir(dir);
+}
+
+/**
+    moves a spreadsheet into a work folder of its own and forks a worker
+    to convert it there
+    @param job is the spreadsheet
+    @param fds are the inotify and signal descriptors, closed in the worker
+    @param mask is the signal mask to restore in the worker
+    @return 1 in the worker, 0 if the worker was started, -1 otherwise
+*/
+static int start_job(Job *job, const int fds[2], const sigset_t *mask) {
+    char work[PATH_MAX];
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    if (snprintf(work, sizeof(work), "%s/.%s", out_dir, job->name) >= (int) sizeof(work) ||
+        snprintf(from, sizeof(from), "%s/%s", watched, job->name) >= (int) sizeof(from) ||
+        snprintf(to, sizeof(to), "%s/%s", work, job->name) >= (int) sizeof(to)) {
+        printf("Skipping \"%s\": its name is too long.\n", job->name);
+        return -1;
+    }
+
+    if (mkdir(work, 0777) != 0 && errno != EEXIST) {
+        printf("Could not create work folder \"%s\".\n", work);
+        return -1;
+    }
+    // a file that is gone was taken by an earlier event
+    if (rename(from, to) != 0) {
+        if (errno != ENOENT)
+            printf("Could not move \"%s\" into \"%s\".\n", from, work);
+        rmdir(work);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        printf("Could not start a worker for \"%s\".\n", job->name);
+        rename(to, from);
+        rmdir(work);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        close(fds[1]);
+        sigprocmask(SIG_SETMASK, mask, NULL);
+
+        // the worker's messages are kept next to its IDoc
+        char log[PATH_MAX];
+        if (snprintf(log, sizeof(log), "%s.log", job->name) >= (int) sizeof(log) || chdir(work) != 0 || freopen(log, "w", stdout) == NULL)
+            _exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    job->pid = pid;
+    printf("Converting \"%s\"\n", job->name);
+    return 0;
+}
+
+/**
+    moves the files of a finished worker to the IDoc folder, or its work
+    folder to the failures folder
+    @param job is the spreadsheet the worker converted
+    @param status is the exit status of the worker
+*/
+static void finish_job(const Job *job, int status) {
+    char work[PATH_MAX];
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    // enqueue made sure that the work folder can be named
+    if (snprintf(work, sizeof(work), "%s/.%s", out_dir, job->name) >= (int) sizeof(work))
+        return;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+        DIR *dir = opendir(work);
+        struct dirent *entry;
+
+        while (dir != NULL && (entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            // a file that can not be moved is left in the work folder
+            if (snprintf(from, sizeof(from), "%s/%s", work, entry->d_name) >= (int) sizeof(from) ||
+                snprintf(to, sizeof(to), "%s/%s", out_dir, entry->d_name) >= (int) sizeof(to) ||
+                rename(from, to) != 0)
+                printf("Could not move \"%s\" from \"%s\" to \"%s\".\n", entry->d_name, work, out_dir);
+        }
+        if (dir != NULL)
+            closedir(dir);
+        rmdir(work);
+        printf("Converted \"%s\" in %.3f s\n", job->name, now() - job->found);
+    } else {
+        // an earlier failure of the same name is not overwritten
+        if ((snprintf(to, sizeof(to), "%s/%s", failed_dir, job->name) >= (int) sizeof(to) || rename(work, to) != 0) &&
+            (snprintf(to, sizeof(to), "%s/%s.%d", failed_dir, job->name, (int) job->pid) >= (int) sizeof(to) ||
+             rename(work, to) != 0))
+            strcpy(to, work);
+        printf("Could not convert \"%s\". See \"%s/%s.log\"\n", job->name, to, job->name);
+    }
+}
+
+/**
+    finishes the jobs of the workers that have exited
+*/
+static void reap_workers(void) {
+    pid_t pid;
+    int status;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < running_count; i++) {
+            if (running[i].pid == pid) {
+                finish_job(&running[i], status);
+                free(running[i].name);
+                running[i] = running[--running_count];
+                break;
+            }
+        }
+    }
+}
+
+/**
+    queues the files of a batch of inotify events
+*/
+static void read_events(int fd) {
+    char events[EVENTS_SIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length = read(fd, events, sizeof(events));
+
+    for (char *e = events; length > 0 && e < events + length;) {
+        const struct inotify_event *event = (const struct inotify_event *) e;
+
+        // events were lost, so the folder is read again
+        if (event->mask & IN_Q_OVERFLOW)
+            scan_folder();
+        else if (event->len > 0 && !(event->mask & IN_ISDIR) && event->name[0] != '.')
+            enqueue(event->name);
+        e += sizeof(struct inotify_event) + event->len;
+    }
+}
+
+int watch_run(const char *dir, int workers, const char **sheet) {
+    sigset_t signals, mask;
+    int fds[2];
+    int status = 0;
+    bool stopping = false;
+
+    // "hot/" has its sibling folders next to it, not inside it
+    size_t length = strlen(dir);
+    while (length > 1 && dir[length - 1] == '/')
+        length--;
+    if (snprintf(watched, sizeof(watched), "%.*s", (int) length, dir) >= (int) sizeof(watched) ||
+        snprintf(out_dir, sizeof(out_dir), "%s" OUT_SUFFIX, watched) >= (int) sizeof(out_dir) ||
+        snprintf(failed_dir, sizeof(failed_dir), "%s" FAILED_SUFFIX, watched) >= (int) sizeof(failed_dir)) {
+        printf("Could not watch folder \"%s\": its name is too long.\n", dir);
+        return -1;
+    }
+
+    if ((fds[0] = inotify_init1(IN_CLOEXEC)) == -1 ||
+        inotify_add_watch(fds[0], watched, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) == -1) {
+        printf("Could not watch folder \"%s\".\n", dir);
+        if (fds[0] != -1)
+            close(fds[0]);
+        return -1;
+    }
+    if ((mkdir(out_dir, 0777) != 0 && errno != EEXIST) || (mkdir(failed_dir, 0777) != 0 && errno != EEXIST)) {
+        printf("Could not create \"%s\" and \"%s\".\n", out_dir, failed_dir);
+        close(fds[0]);
+        return -1;
+    }
+
+    // exiting workers and Ctrl-C are read as events too
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, &mask);
+    if ((fds[1] = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        printf("Could not watch folder \"%s\".\n", dir);
+        close(fds[0]);
+        return -1;
+    }
+
+    if (workers < 1)
+        workers = 1;
+    if ((running = (Job *) malloc(workers * sizeof(Job))) == NULL)
+        status = -1;
+
+    // files dropped while nobody was watching
+    scan_folder();
+    printf("Watching \"%s\" on %d workers. IDocs go to \"%s\", failures to \"%s\". Ctrl-C stops.\n",
+           dir, workers, out_dir, failed_dir);
+
+    while (running != NULL && (!stopping || running_count > 0)) {
+        while (!stopping && running_count < workers && pending_count > 0) {
+            Job job = pending[0];
+            memmove(pending, pending + 1, --pending_count * sizeof(Job));
+
+            int started = start_job(&job, fds, &mask);
+            if (started == 1) {
+                *sheet = job.name;
+                return 1;
+            } else if (started == 0)
+                running[running_count++] = job;
+            else
+                free(job.name);
+        }
+
+        struct pollfd polled[2] = {{fds[0], POLLIN, 0}, {fds[1], POLLIN, 0}};
+        if (poll(polled, 2, -1) == -1 && errno != EINTR) {
+            status = -1;
+            break;
+        }
+
+        if (polled[0].revents & POLLIN)
+            read_events(fds[0]);
+        if (polled[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(fds[1], &info, sizeof(info)) == sizeof(info))
+                if (info.ssi_signo != SIGCHLD && !stopping) {
+                    printf("Stopping once the running conversions are done.\n");
+                    stopping = true;
+                }
+            reap_workers();
+        }
+        fflush(stdout);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    for (int i = 0; i < pending_count; i++)
+        free(pending[i].name);
+    free(pending);
+    free(running);
+    printf("Stopped watching \"%s\".\n", dir);
+    return status;
+}
+
+#else
+
+int watch_run(const char *dir, int workers, const char **sheet) {
+    printf("--watch is not available in this build.\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,32 @@
+/**
+    @file watch.h
+    Together with watch.c, this component is responsible for the hot
+    folder (--watch DIR): spreadsheets dropped into the folder are found
+    through inotify as soon as they are complete and converted at once by
+    worker processes forked from the already initialized program.
+*/
+
+#ifndef STOIDOC_WATCH_H
+#define STOIDOC_WATCH_H
+
+/**
+    watches a folder until the program is interrupted. Every regular file
+    that is written and closed in, or moved into, the folder (and every one
+    already there) is moved into a work folder of its own under
+    "<DIR>-idoc", and a worker process is forked to convert it there. Once
+    the worker exits, its IDoc, its messages (in "<file>.log") and the
+    spreadsheet are moved to "<DIR>-idoc" if it succeeded, and the work
+    folder is moved to "<DIR>-failed/<file>" if it did not. Hidden files
+    (".name") are left alone, so a file can be written under a hidden name
+    and then renamed into place.
+    @param dir is the folder to watch
+    @param workers is the maximum number of worker processes
+    @param sheet receives, in a worker process, the name of the spreadsheet
+    to convert; the worker's current directory is its work folder and its
+    messages go to the log file
+    @return 1 in a worker process, 0 in the watching process once it was
+    interrupted and its workers are done, -1 if the folder can not be watched
+*/
+int watch_run(const char *dir, int workers, const char **sheet);
+
+#endif //STOIDOC_WATCH_H
@@ -0,0 +1,877 @@
+/**
+ *  xlsx.c
+ */
+#include "xlsx.h"
+#include "text.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* size of the chunks inflated from the workbook and written to the pipe */
+#define XLSX_CHUNK        (64 * 1024)
+
+/* zip record signatures and the lengths of their fixed parts            */
+#define EOCD_SIGNATURE    0x06054b50
+#define CENTRAL_SIGNATURE 0x02014b50
+#define LOCAL_SIGNATURE   0x04034b50
+#define EOCD_LEN          22
+#define CENTRAL_LEN       46
+#define LOCAL_LEN         30
+
+/* the end of central directory record may be followed by a comment      */
+#define EOCD_SEARCH       (EOCD_LEN + 0xffff)
+
+/* zip compression methods                                               */
+#define ZIP_STORED        0
+#define ZIP_DEFLATED      8
+
+/* maximum length of the name of a workbook part                         */
+#define PART_NAME_LEN     256
+
+/* maximum number of attributes of an XML element                        */
+#define MAX_ATTRS         32
+
+/* the parts of a workbook, and where they usually are                   */
+#define WORKBOOK_PART     "xl/workbook.xml"
+#define WORKBOOK_RELS     "xl/_rels/workbook.xml.rels"
+#define PART_DIRECTORY    "xl/"
+#define DEFAULT_SHEET     "xl/worksheets/sheet1.xml"
+#define DEFAULT_STRINGS   "xl/sharedStrings.xml"
+
+/* the types of cell value, from the t attribute of a cell               */
+enum cell_type {CELL_NUMBER, CELL_SHARED, CELL_STRING, CELL_BOOLEAN, CELL_ERROR};
+
+/** a growing, NUL terminated text buffer                                */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t cap;
+} Text;
+
+/** an entry of the zip central directory                                */
+typedef struct {
+    char name[PART_NAME_LEN];
+    int method;
+    uint32_t size;
+    uint32_t offset;
+} Zip_entry;
+
+/** a zip archive and its central directory                              */
+typedef struct {
+    FILE *file;
+    Zip_entry *entries;
+    int count;
+} Zip_archive;
+
+/** an XML parser fed in chunks, reporting elements and text as it goes   */
+typedef struct {
+    int (*start)(void *ctx, const char *name, const char **attrs);
+    int (*end)(void *ctx, const char *name);
+    int (*text)(void *ctx, const char *text, size_t length);
+    void *ctx;
+    bool in_tag;
+    char quote;
+    Text tag;
+    Text content;
+} Sax;
+
+/** the relationship id and the parts of the first worksheet              */
+typedef struct {
+    char sheet_id[PART_NAME_LEN];
+    char sheet[PART_NAME_LEN];
+    char strings[PART_NAME_LEN];
+} Workbook;
+
+/** the shared strings table, one NUL terminated string after the other  */
+typedef struct {
+    Text chars;
+    size_t *offsets;
+    size_t count;
+    size_t cap;
+    Text current;
+    bool in_si;
+    bool in_t;
+    int phonetic;
+} Strings;
+
+/** the state of the worksheet parser and the rows written to the pipe   */
+typedef struct {
+    const Strings *strings;
+    int fd;
+    Text out;
+    Text row;
+    Text value;
+    enum cell_type type;
+    int column;
+    int next_column;
+    int written;
+    int tabs;
+    bool in_v;
+    bool in_is;
+    bool in_t;
+    int phonetic;
+} Sheet;
+
+/**
+    appends bytes to a text buffer
+    @return 0 if successful, -1 if out of memory
+*/
+static int text_append(Text *text, const char *data, size_t length) {
+    if (text->length + length + 1 > text->cap) {
+        size_t cap = text->cap ? text->cap : 256;
+        while (cap < text->length + length + 1)
+            cap *= 2;
+        char *grown = (char *) realloc(text->data, cap);
+        if (grown == NULL)
+            return -1;
+        text->data = grown;
+        text->cap = cap;
+    }
+    memcpy(text->data + text->length, data, length);
+    text->length += length;
+    text->data[text->length] = '\0';
+    return 0;
+}
+
+static uint32_t le16(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+    replaces the XML entity and character references of a string in place;
+    a reference is never shorter than what it stands for
+    @return the new length of the string
+*/
+static size_t decode_entities(char *s, size_t length) {
+    size_t r = 0, w = 0;
+
+    while (r < length) {
+        char *semi;
+        if (s[r] == '&' && (semi = (char *) memchr(s + r, ';', length - r)) != NULL && semi - (s + r) <= 10) {
+            char *name = s + r + 1;
+            size_t name_len = (size_t) (semi - name);
+            char c = 0;
+
+            if (name_len == 2 && strncmp(name, "lt", 2) == 0)
+                c = '<';
+            else if (name_len == 2 && strncmp(name, "gt", 2) == 0)
+                c = '>';
+            else if (name_len == 3 && strncmp(name, "amp", 3) == 0)
+                c = '&';
+            else if (name_len == 4 && strncmp(name, "quot", 4) == 0)
+                c = '"';
+            else if (name_len == 4 && strncmp(name, "apos", 4) == 0)
+                c = '\'';
+            else if (name_len > 1 && name[0] == '#') {
+                char *end;
+                unsigned long code = name[1] == 'x' ? strtoul(name + 2, &end, 16) : strtoul(name + 1, &end, 10);
+                if (end == semi && code > 0 && code <= 0x10ffff) {
+                    w += text_utf8_encode(s + w, code);
+                    r += name_len + 2;
+                    continue;
+                }
+            }
+            if (c) {
+                s[w++] = c;
+                r += name_len + 2;
+                continue;
+            }
+        }
+        s[w++] = s[r++];
+    }
+    s[w] = '\0';
+    return w;
+}
+
+/**
+    replaces the _xHHHH_ escapes Excel writes for control characters in
+    cell text, in place
+*/
+static void decode_escapes(Text *text) {
+    char *s = text->data;
+    size_t r = 0, w = 0;
+
+    if (s == NULL || memchr(s, '_', text->length) == NULL)
+        return;
+    while (r < text->length) {
+        if (s[r] == '_' && r + 7 <= text->length && s[r + 1] == 'x' && s[r + 6] == '_' &&
+            isxdigit((unsigned char) s[r + 2]) && isxdigit((unsigned char) s[r + 3]) &&
+            isxdigit((unsigned char) s[r + 4]) && isxdigit((unsigned char) s[r + 5])) {
+            w += text_utf8_encode(s + w, strtoul((char[]) {s[r + 2], s[r + 3], s[r + 4], s[r + 5], '\0'}, NULL, 16));
+            r += 7;
+        } else
+            s[w++] = s[r++];
+    }
+    s[w] = '\0';
+    text->length = w;
+}
+
+static const char *local_name(const char *name) {
+    const char *colon = strrchr(name, ':');
+    return colon ? colon + 1 : name;
+}
+
+/**
+    finds an attribute of an element by its name without namespace prefix
+    @return the value of the attribute, or NULL if the element has none
+*/
+static const char *attribute(const char **attrs, const char *name) {
+    for (; *attrs; attrs += 2)
+        if (strcmp(local_name(attrs[0]), name) == 0)
+            return attrs[1];
+    return NULL;
+}
+
+/**
+    reports the text gathered since the last tag
+    @return 0 if successful, -1 if the handler failed
+*/
+static int sax_flush_text(Sax *sax) {
+    int status = 0;
+
+    if (sax->content.length > 0 && sax->text) {
+        if (memchr(sax->content.data, '&', sax->content.length) != NULL)
+            sax->content.length = decode_entities(sax->content.data, sax->content.length);
+        status = sax->text(sax->ctx, sax->content.data, sax->content.length);
+    }
+    sax->content.length = 0;
+    return status;
+}
+
+/**
+    reports a complete tag: the text between '<' and '>'
+    @return 0 if successful, -1 if a handler failed
+*/
+static int sax_tag(Sax *sax) {
+    char *tag = sax->tag.data;
+    size_t length = sax->tag.length;
+    const char *attrs[2 * MAX_ATTRS + 1];
+    int count = 0;
+
+    if (length == 0 || tag[0] == '?')
+        return 0;
+    if (tag[0] == '!') {
+        // character data is reported as it is; comments and declarations are skipped
+        if (length >= 10 && strncmp(tag, "![CDATA[", 8) == 0 && sax->text)
+            return sax->text(sax->ctx, tag + 8, length - 10);
+        return 0;
+    }
+    if (tag[0] == '/') {
+        char *name = tag + 1;
+        for (char *p = name; *p; p++)
+            if (isspace((unsigned char) *p))
+                *p = '\0';
+        return sax->end(sax->ctx, local_name(name));
+    }
+
+    bool empty = tag[length - 1] == '/';
+    if (empty)
+        tag[--length] = '\0';
+
+    char *p = tag;
+    while (*p && !isspace((unsigned char) *p))
+        p++;
+    if (*p)
+        *p++ = '\0';
+
+    while (*p) {
+        while (isspace((unsigned char) *p))
+            p++;
+        char *name = p;
+        while (*p && *p != '=' && !isspace((unsigned char) *p))
+            p++;
+        char *name_end = p;
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p != '=')
+            break;
+        p++;
+        while (isspace((unsigned char) *p))
+            p++;
+        char quote = *p;
+        if (quote != '"' && quote != '\'')
+            break;
+        char *value = ++p;
+        while (*p && *p != quote)
+            p++;
+        if (*p)
+            *p++ = '\0';
+        *name_end = '\0';
+        if (strchr(value, '&') != NULL)
+            decode_entities(value, strlen(value));
+        if (count < MAX_ATTRS) {
+            attrs[2 * count] = name;
+            attrs[2 * count + 1] = value;
+            count++;
+        }
+    }
+    attrs[2 * count] = NULL;
+
+    const char *name = local_name(tag);
+    if (sax->start(sax->ctx, name, attrs) != 0)
+        return -1;
+    return empty ? sax->end(sax->ctx, name) : 0;
+}
+
+/**
+    reports whether the '>' just read closes the tag: comments and
+    character data may hold '>' themselves
+*/
+static bool tag_complete(const Text *tag) {
+    if (tag->length == 0 || tag->data[0] != '!')
+        return true;
+    if (tag->length >= 3 && strncmp(tag->data, "!--", 3) == 0)
+        return tag->length >= 5 && strncmp(tag->data + tag->length - 2, "--", 2) == 0;
+    if (tag->length >= 8 && strncmp(tag->data, "![CDATA[", 8) == 0)
+        return strncmp(tag->data + tag->length - 2, "]]", 2) == 0;
+    return true;
+}
+
+/**
+    parses the next chunk of an XML document; elements and text may span
+    chunks
+    @return 0 if successful, -1 if a handler failed or out of memory
+*/
+static int sax_feed(Sax *sax, const char *data, size_t length) {
+    const char *end = data + length;
+
+    while (data < end) {
+        if (!sax->in_tag) {
+            const char *open = (const char *) memchr(data, '<', (size_t) (end - data));
+            const char *stop = open ? open : end;
+
+            if (stop > data && text_append(&sax->content, data, (size_t) (stop - data)) != 0)
+                return -1;
+            data = stop;
+            if (open) {
+                if (sax_flush_text(sax) != 0)
+                    return -1;
+                sax->in_tag = true;
+                data++;
+            }
+            continue;
+        }
+
+        // the tag runs to the first '>' outside quoted attribute values
+        bool raw = (sax->tag.length ? sax->tag.data[0] : *data) == '!';
+        const char *p = data;
+        while (p < end) {
+            if (sax->quote) {
+                const char *close = (const char *) memchr(p, sax->quote, (size_t) (end - p));
+                if (close == NULL) {
+                    p = end;
+                    break;
+                }
+                sax->quote = 0;
+                p = close + 1;
+            } else if (*p == '>')
+                break;
+            else {
+                if (!raw && (*p == '"' || *p == '\''))
+                    sax->quote = *p;
+                p++;
+            }
+        }
+
+        if (p > data && text_append(&sax->tag, data, (size_t) (p - data)) != 0)
+            return -1;
+        if (p == end)
+            break;
+        data = p + 1;
+
+        if (tag_complete(&sax->tag)) {
+            if (sax_tag(sax) != 0)
+                return -1;
+            sax->tag.length = 0;
+            sax->in_tag = false;
+        } else if (text_append(&sax->tag, p, 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void sax_release(Sax *sax) {
+    free(sax->tag.data);
+    free(sax->content.data);
+}
+
+/**
+    reads the central directory of a zip archive
+    @return 0 if successful, -1 if the file is not a readable zip archive
+*/
+static int zip_open(Zip_archive *zip, FILE *file) {
+    unsigned char *tail, *directory;
+    long size, start;
+    size_t tail_len;
+    uint32_t count, directory_size, directory_offset;
+
+    zip->file = file;
+    zip->entries = NULL;
+    zip->count = 0;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < EOCD_LEN)
+        return -1;
+
+    start = size > EOCD_SEARCH ? size - EOCD_SEARCH : 0;
+    tail_len = (size_t) (size - start);
+    if ((tail = (unsigned char *) malloc(tail_len)) == NULL)
+        return -1;
+    if (fseek(file, start, SEEK_SET) != 0 || fread(tail, 1, tail_len, file) != tail_len) {
+        free(tail);
+        return -1;
+    }
+
+    // the end of central directory record is the last one in the file
+    long eocd = (long) tail_len - EOCD_LEN;
+    while (eocd >= 0 && le32(tail + eocd) != EOCD_SIGNATURE)
+        eocd--;
+    if (eocd < 0) {
+        free(tail);
+        return -1;
+    }
+    count = le16(tail + eocd + 10);
+    directory_size = le32(tail + eocd + 12);
+    directory_offset = le32(tail + eocd + 16);
+    free(tail);
+
+    // zip64 archives are not expected from a label workbook
+    if ((long) directory_offset + (long) directory_size > size)
+        return -1;
+
+    if ((directory = (unsigned char *) malloc(directory_size + 1)) == NULL ||
+        (zip->entries = (Zip_entry *) calloc(count + 1, sizeof(Zip_entry))) == NULL ||
+        fseek(file, (long) directory_offset, SEEK_SET) != 0 ||
+        fread(directory, 1, directory_size, file) != directory_size) {
+        free(directory);
+        free(zip->entries);
+        zip->entries = NULL;
+        return -1;
+    }
+
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count && pos + CENTRAL_LEN <= directory_size; i++) {
+        unsigned char *record = directory + pos;
+        uint32_t name_len = le16(record + 28);
+
+        if (le32(record) != CENTRAL_SIGNATURE || pos + CENTRAL_LEN + name_len > directory_size)
+            break;
+
+        Zip_entry *entry = &zip->entries[zip->count++];
+        entry->method = (int) le16(record + 10);
+        entry->size = le32(record + 20);
+        entry->offset = le32(record + 42);
+        // names too long for a workbook part are left empty
+        if (name_len < PART_NAME_LEN) {
+            memcpy(entry->name, record + CENTRAL_LEN, name_len);
+            entry->name[name_len] = '\0';
+        }
+        pos += CENTRAL_LEN + name_len + le16(record + 30) + le16(record + 32);
+    }
+    free(directory);
+    return 0;
+}
+
+static const Zip_entry *zip_find(const Zip_archive *zip, const char *name) {
+    for (int i = 0; i < zip->count; i++)
+        if (strcmp(zip->entries[i].name, name) == 0)
+            return &zip->entries[i];
+    return NULL;
+}
+
+/**
+    inflates an entry of the archive chunk by chunk into an XML parser
+    @return 0 if successful, -1 otherwise
+*/
+static int zip_parse(const Zip_archive *zip, const Zip_entry *entry, Sax *sax) {
+    unsigned char header[LOCAL_LEN];
+    unsigned char *in, *out;
+    uint32_t remaining = entry->size;
+    int status = 0;
+
+    if (fseek(zip->file, (long) entry->offset, SEEK_SET) != 0 ||
+        fread(header, 1, LOCAL_LEN, zip->file) != LOCAL_LEN || le32(header) != LOCAL_SIGNATURE ||
+        fseek(zip->file, (long) (le16(header + 26) + le16(header + 28)), SEEK_CUR) != 0)
+        return -1;
+
+    in = (unsigned char *) malloc(XLSX_CHUNK);
+    out = (unsigned char *) malloc(XLSX_CHUNK);
+    if (in == NULL || out == NULL) {
+        free(in);
+        free(out);
+        return -1;
+    }
+
+    if (entry->method == ZIP_STORED) {
+        while (status == 0 && remaining > 0) {
+            size_t n = fread(in, 1, remaining < XLSX_CHUNK ? remaining : XLSX_CHUNK, zip->file);
+            if (n == 0 || sax_feed(sax, (const char *) in, n) != 0)
+                status = -1;
+            remaining -= (uint32_t) n;
+        }
+    }
+#ifdef HAVE_ZLIB
+    else if (entry->method == ZIP_DEFLATED) {
+        z_stream zs = {0};
+        int ret = Z_OK;
+
+        // negative windowBits selects raw deflate data, without a header
+        if (inflateInit2(&zs, -15) != Z_OK) {
+            free(in);
+            free(out);
+            return -1;
+        }
+        while (status == 0 && ret != Z_STREAM_END) {
+            if (zs.avail_in == 0) {
+                size_t n = remaining < XLSX_CHUNK ? remaining : XLSX_CHUNK;
+                if (n == 0 || fread(in, 1, n, zip->file) != n) {
+                    status = -1;
+                    break;
+                }
+                remaining -= (uint32_t) n;
+                zs.next_in = in;
+                zs.avail_in = (uInt) n;
+            }
+            zs.next_out = out;
+            zs.avail_out = XLSX_CHUNK;
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END)
+                status = -1;
+            else if (sax_feed(sax, (const char *) out, XLSX_CHUNK - zs.avail_out) != 0)
+                status = -1;
+        }
+        inflateEnd(&zs);
+    }
+#endif
+    else
+        status = -1;
+
+    // text after the last tag is reported too
+    if (status == 0 && sax_flush_text(sax) != 0)
+        status = -1;
+
+    free(in);
+    free(out);
+    return status;
+}
+
+/**
+    turns the target of a workbook relationship into the name of a part
+*/
+static void part_name(char *dest, const char *target) {
+    if (target[0] == '/')
+        snprintf(dest, PART_NAME_LEN, "%s", target + 1);
+    else
+        snprintf(dest, PART_NAME_LEN, "%s%s", PART_DIRECTORY, target);
+}
+
+static int workbook_start(void *ctx, const char *name, const char **attrs) {
+    Workbook *book = (Workbook *) ctx;
+    const char *id;
+
+    // the first sheet element is the first worksheet of the workbook
+    if (book->sheet_id[0] == '\0' && strcmp(name, "sheet") == 0 && (id = attribute(attrs, "id")) != NULL)
+        snprintf(book->sheet_id, PART_NAME_LEN, "%s", id);
+    return 0;
+}
+
+static int rels_start(void *ctx, const char *name, const char **attrs) {
+    Workbook *book = (Workbook *) ctx;
+    const char *id = attribute(attrs, "Id");
+    const char *type = attribute(attrs, "Type");
+    const char *target = attribute(attrs, "Target");
+    size_t type_len;
+
+    if (strcmp(name, "Relationship") != 0 || id == NULL || type == NULL || target == NULL)
+        return 0;
+    type_len = strlen(type);
+    if (strcmp(id, book->sheet_id) == 0)
+        part_name(book->sheet, target);
+    else if (type_len >= strlen("/sharedStrings") && strcmp(type + type_len - strlen("/sharedStrings"), "/sharedStrings") == 0)
+        part_name(book->strings, target);
+    return 0;
+}
+
+static int ignore_end(void *ctx, const char *name) {
+    (void) ctx;
+    (void) name;
+    return 0;
+}
+
+/**
+    looks up the parts of the first worksheet and of the shared strings
+    table, keeping the usual names of any that cannot be found
+*/
+static void workbook_locate(const Zip_archive *zip, Workbook *book) {
+    const Zip_entry *entry;
+    Sax sax = {workbook_start, ignore_end, NULL, book, false, '\0', {NULL, 0, 0}, {NULL, 0, 0}};
+
+    snprintf(book->sheet, PART_NAME_LEN, "%s", DEFAULT_SHEET);
+    snprintf(book->strings, PART_NAME_LEN, "%s", DEFAULT_STRINGS);
+    book->sheet_id[0] = '\0';
+
+    if ((entry = zip_find(zip, WORKBOOK_PART)) != NULL)
+        zip_parse(zip, entry, &sax);
+    sax_release(&sax);
+
+    if (book->sheet_id[0] != '\0' && (entry = zip_find(zip, WORKBOOK_RELS)) != NULL) {
+        sax = (Sax) {rels_start, ignore_end, NULL, book, false, '\0', {NULL, 0, 0}, {NULL, 0, 0}};
+        zip_parse(zip, entry, &sax);
+        sax_release(&sax);
+    }
+}
+
+static int strings_start(void *ctx, const char *name, const char **attrs) {
+    Strings *strings = (Strings *) ctx;
+    (void) attrs;
+
+    if (strcmp(name, "si") == 0) {
+        strings->in_si = true;
+        strings->current.length = 0;
+    } else if (strcmp(name, "rPh") == 0)
+        strings->phonetic++;
+    else if (strcmp(name, "t") == 0 && strings->in_si && strings->phonetic == 0)
+        strings->in_t = true;
+    return 0;
+}
+
+static int strings_end(void *ctx, const char *name) {
+    Strings *strings = (Strings *) ctx;
+
+    if (strcmp(name, "t") == 0)
+        strings->in_t = false;
+    else if (strcmp(name, "rPh") == 0)
+        strings->phonetic--;
+    else if (strcmp(name, "si") == 0) {
+        strings->in_si = false;
+        if (strings->count == strings->cap) {
+            size_t cap = strings->cap ? 2 * strings->cap : 1024;
+            size_t *grown = (size_t *) realloc(strings->offsets, cap * sizeof(size_t));
+            if (grown == NULL)
+                return -1;
+            strings->offsets = grown;
+            strings->cap = cap;
+        }
+        decode_escapes(&strings->current);
+        strings->offsets[strings->count++] = strings->chars.length;
+        if (text_append(&strings->chars, strings->current.data ? strings->current.data : "",
+                        strings->current.length) != 0 ||
+            text_append(&strings->chars, "", 1) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int strings_text(void *ctx, const char *text, size_t length) {
+    Strings *strings = (Strings *) ctx;
+    return strings->in_t ? text_append(&strings->current, text, length) : 0;
+}
+
+/**
+    writes the rows gathered so far to the pipe
+    @return 0 if successful, -1 if the reading end was closed
+*/
+static int sheet_flush(Sheet *sheet) {
+    const char *data = sheet->out.data;
+    size_t length = sheet->out.length;
+
+    while (length > 0) {
+        ssize_t written = write(sheet->fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        data += written;
+        length -= (size_t) written;
+    }
+    sheet->out.length = 0;
+    return 0;
+}
+
+/**
+    translates the column letters of a cell reference such as "AB12"
+    @return the zero based column, or -1 if the reference has no letters
+*/
+static int reference_column(const char *reference) {
+    int column = 0;
+
+    for (; *reference >= 'A' && *reference <= 'Z'; reference++)
+        column = column * 26 + (*reference - 'A' + 1);
+    return column - 1;
+}
+
+/**
+    adds the value of the cell just read to the row, quoted as Excel
+    quotes a cell holding a quote, a tab or a line break
+    @return 0 if successful, -1 if out of memory
+*/
+static int sheet_cell(Sheet *sheet) {
+    const char *value = sheet->value.data ? sheet->value.data : "";
+    char number[32];
+
+    if (sheet->type == CELL_SHARED) {
+        char *end;
+        long index = strtol(value, &end, 10);
+        if (end == value || index < 0 || (size_t) index >= sheet->strings->count)
+            return 0;
+        value = sheet->strings->chars.data + sheet->strings->offsets[index];
+    } else if (sheet->type == CELL_BOOLEAN)
+        value = strcmp(value, "1") == 0 ? "TRUE" : "FALSE";
+    else if (sheet->type == CELL_STRING) {
+        decode_escapes(&sheet->value);
+        value = sheet->value.data ? sheet->value.data : "";
+    } else if (sheet->type == CELL_NUMBER && value[strspn(value, "0123456789")] != '\0') {
+        // numbers are stored in full; print them as the General format shows them
+        char *end;
+        double d = strtod(value, &end);
+        if (*end == '\0') {
+            if (d > -1e15 && d < 1e15 && d == (double) (long long) d)
+                snprintf(number, sizeof(number), "%lld", (long long) d);
+            else
+                snprintf(number, sizeof(number), "%.15g", d);
+            value = number;
+        }
+    }
+
+    // a cell out of order would shift the columns that follow it
+    if (*value == '\0' || sheet->column <= sheet->written)
+        return 0;
+    sheet->written = sheet->column;
+
+    // the cells the row skips are left empty
+    while (sheet->tabs < sheet->column) {
+        if (text_append(&sheet->row, "\t", 1) != 0)
+            return -1;
+        sheet->tabs++;
+    }
+
+    if (strpbrk(value, "\"\t\r\n") == NULL)
+        return text_append(&sheet->row, value, strlen(value));
+
+    if (text_append(&sheet->row, "\"", 1) != 0)
+        return -1;
+    for (const char *quote; (quote = strchr(value, '"')) != NULL; value = quote + 1)
+        if (text_append(&sheet->row, value, (size_t) (quote - value) + 1) != 0 ||
+            text_append(&sheet->row, "\"", 1) != 0)
+            return -1;
+    if (text_append(&sheet->row, value, strlen(value)) != 0 || text_append(&sheet->row, "\"", 1) != 0)
+        return -1;
+    return 0;
+}
+
+static int sheet_start(void *ctx, const char *name, const char **attrs) {
+    Sheet *sheet = (Sheet *) ctx;
+
+    if (strcmp(name, "row") == 0) {
+        sheet->row.length = 0;
+        sheet->tabs = 0;
+        sheet->next_column = 0;
+        sheet->written = -1;
+    } else if (strcmp(name, "c") == 0) {
+        const char *reference = attribute(attrs, "r");
+        const char *type = attribute(attrs, "t");
+        int column = reference ? reference_column(reference) : -1;
+
+        sheet->column = column >= 0 ? column : sheet->next_column;
+        sheet->next_column = sheet->column + 1;
+        if (type == NULL || strcmp(type, "n") == 0)
+            sheet->type = CELL_NUMBER;
+        else if (strcmp(type, "s") == 0)
+            sheet->type = CELL_SHARED;
+        else if (strcmp(type, "b") == 0)
+            sheet->type = CELL_BOOLEAN;
+        else if (strcmp(type, "e") == 0)
+            sheet->type = CELL_ERROR;
+        else
+            sheet->type = CELL_STRING;
+        sheet->value.length = 0;
+        if (sheet->value.data)
+            sheet->value.data[0] = '\0';
+    } else if (strcmp(name, "v") == 0)
+        sheet->in_v = true;
+    else if (strcmp(name, "is") == 0)
+        sheet->in_is = true;
+    else if (strcmp(name, "rPh") == 0)
+        sheet->phonetic++;
+    else if (strcmp(name, "t") == 0 && sheet->in_is && sheet->phonetic == 0)
+        sheet->in_t = true;
+    return 0;
+}
+
+static int sheet_end(void *ctx, const char *name) {
+    Sheet *sheet = (Sheet *) ctx;
+
+    if (strcmp(name, "v") == 0)
+        sheet->in_v = false;
+    else if (strcmp(name, "t") == 0)
+        sheet->in_t = false;
+    else if (strcmp(name, "is") == 0)
+        sheet->in_is = false;
+    else if (strcmp(name, "rPh") == 0)
+        sheet->phonetic--;
+    else if (strcmp(name, "c") == 0)
+        return sheet_cell(sheet);
+    else if (strcmp(name, "row") == 0 && sheet->row.length > 0) {
+        // rows without any value are left out, as the text reader skips them
+        if (text_append(&sheet->out, sheet->row.data, sheet->row.length) != 0 ||
+            text_append(&sheet->out, "\n", 1) != 0)
+            return -1;
+        if (sheet->out.length >= XLSX_CHUNK)
+            return sheet_flush(sheet);
+    }
+    return 0;
+}
+
+static int sheet_text(void *ctx, const char *text, size_t length) {
+    Sheet *sheet = (Sheet *) ctx;
+    return sheet->in_v || sheet->in_t ? text_append(&sheet->value, text, length) : 0;
+}
+
+bool xlsx_magic(const unsigned char *magic, size_t length) {
+    return length >= 4 && magic[0] == 'P' && magic[1] == 'K' && magic[2] == 3 && magic[3] == 4;
+}
+
+int xlsx_convert(FILE *file, int fd) {
+    Zip_archive zip;
+    Workbook book;
+    Strings strings = {0};
+    Sheet sheet = {0};
+    Sax sax;
+    const Zip_entry *entry;
+    int status = -1;
+
+    if (zip_open(&zip, file) != 0)
+        return -1;
+    workbook_locate(&zip, &book);
+
+    // a workbook holding nothing but numbers has no shared strings
+    sax = (Sax) {strings_start, strings_end, strings_text, &strings, false, '\0', {NULL, 0, 0}, {NULL, 0, 0}};
+    if ((entry = zip_find(&zip, book.strings)) == NULL || zip_parse(&zip, entry, &sax) == 0) {
+        sax_release(&sax);
+        sheet.strings = &strings;
+        sheet.fd = fd;
+        sax = (Sax) {sheet_start, sheet_end, sheet_text, &sheet, false, '\0', {NULL, 0, 0}, {NULL, 0, 0}};
+        if ((entry = zip_find(&zip, book.sheet)) != NULL && zip_parse(&zip, entry, &sax) == 0 &&
+            sheet_flush(&sheet) == 0)
+            status = 0;
+    }
+    sax_release(&sax);
+
+    free(strings.chars.data);
+    free(strings.offsets);
+    free(strings.current.data);
+    free(sheet.out.data);
+    free(sheet.row.data);
+    free(sheet.value.data);
+    free(zip.entries);
+    return status;
+}
@@ -0,0 +1,35 @@
+/**
+    @file xlsx.h
+    Together with xlsx.c, this component is responsible for reading the
+    label spreadsheet straight from an Excel workbook (.xlsx). The first
+    worksheet is unzipped and parsed as a stream of XML events, and its
+    rows are written out as the tab-delimited text of Excel's own export,
+    so that the rest of the program reads them like any other spreadsheet.
+*/
+
+#ifndef STOIDOC_XLSX_H
+#define STOIDOC_XLSX_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+    reports whether the first bytes of a file are those of a zip archive
+    @param magic holds the first bytes of the file
+    @param length is the number of bytes in magic
+    @return true if the file may be a workbook
+*/
+bool xlsx_magic(const unsigned char *magic, size_t length);
+
+/**
+    writes the first worksheet of a workbook to a pipe as tab-delimited
+    rows. Only the shared strings table is kept in memory; the worksheet
+    is inflated and parsed in fixed size chunks. Cells holding a quote, a
+    tab or a line break are quoted the way Excel exports them.
+    @param file is the workbook, which must be seekable
+    @param fd is the writing end of the pipe
+    @return 0 if successful, -1 if the workbook could not be read
+*/
+int xlsx_convert(FILE *file, int fd);
+
+#endif //STOIDOC_XLSX_H